@@ -1,13 +1,18 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
-// cached copies of disk block contents.  Caching disk blocks
+// The buffer cache is a hash table of buf structures holding
+// cached copies of disk block contents, keyed by (dev, blockno).
+// Each bucket has its own lock and its own LRU list, so
+// lookups of blocks in different buckets don't contend.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * To have a block read into the cache ahead of the bread
+//     that will want it, call bprefetch.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bwritestart and later bwait to write several at once.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -23,69 +28,197 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 13
+#define BHASH(dev, blockno) ((((dev) << 16) ^ (blockno)) % NBUCKET)
+#define MAXRA   (NBUF/3)  // most bufs read ahead but not yet used
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of the bucket's buffers, through prev/next.
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+};
+
+struct {
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  int nra;  // bufs with ra set
 } bcache;
 
+// Insert b at the most-recently-used end of bk's list.
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Spread the (unused) buffers over the buckets.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bpush(&bcache.bucket[(b - bcache.buf) % NBUCKET], b);
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Look for block on device dev in bucket bk, whose lock must be held.
+// If found, take a reference to it and return it.
 static struct buf*
-bget(uint dev, uint blockno)
+blookup(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+// A buf read ahead is no longer waiting to be used.
+// Caller must hold its bucket's lock.
+static void
+bunra(struct buf *b)
+{
+  if(b->ra){
+    b->ra = 0;
+    __sync_fetch_and_sub(&bcache.nra, 1);
+  }
+}
+
+// Find the least recently used unused buffer in bucket bk,
+// whose lock must be held.  A buffer being read ahead is in
+// use by the disk.
+static struct buf*
+blru(struct bucket *bk)
+{
+  struct buf *b;
+
+  for(b = bk->head.prev; b != &bk->head; b = b->prev){
+    if(b->refcnt == 0 && !b->disk){
+      bunra(b);
       return b;
     }
   }
-  panic("bget: no buffers");
+  return 0;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer, once the disk is
+// done reading it ahead.
+// For bprefetch (ra set), return 0 instead if the block is
+// already cached or no buffer is free.
+static struct buf*
+bget(uint dev, uint blockno, int ra)
+{
+  struct buf *b, *other;
+  struct bucket *bk, *victim;
+  int h, i;
+
+  h = BHASH(dev, blockno);
+  bk = &bcache.bucket[h];
+  acquire(&bk->lock);
+
+  // Is the block already cached?
+  if((b = blookup(bk, dev, blockno)) != 0){
+    if(ra){
+      b->refcnt--;
+      release(&bk->lock);
+      return 0;
+    }
+    bunra(b);
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    if(b->disk)
+      blkwait(b);
+    return b;
+  }
+
+  // Not cached.
+  // Recycle the least recently used (LRU) unused buffer
+  // of this bucket, if it has one.
+  if((b = blru(bk)) != 0)
+    goto found;
+  release(&bk->lock);
+
+  // Otherwise take one from another bucket.  Only one bucket
+  // lock is held at a time, so there is no lock order to obey,
+  // but another process may cache the block meanwhile.
+  for(i = 1; i < NBUCKET; i++){
+    victim = &bcache.bucket[(h + i) % NBUCKET];
+    acquire(&victim->lock);
+    if((b = blru(victim)) != 0){
+      bunlink(b);
+      release(&victim->lock);
+      break;
+    }
+    release(&victim->lock);
+  }
+  if(b == 0){
+    if(ra)
+      return 0;
+    panic("bget: no buffers");
+  }
+
+  // b is on no list now, so no one else can find it.
+  b->dev = 0;
+  b->valid = 0;
+
+  acquire(&bk->lock);
+  bpush(bk, b);
+  if((other = blookup(bk, dev, blockno)) != 0){
+    // Someone else cached the block meanwhile;
+    // leave the stolen buffer here unused.
+    if(ra){
+      other->refcnt--;
+      release(&bk->lock);
+      return 0;
+    }
+    bunra(other);
+    release(&bk->lock);
+    acquiresleep(&other->lock);
+    if(other->disk)
+      blkwait(other);
+    return other;
+  }
+
+found:
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  if(ra){
+    b->ra = 1;
+    __sync_fetch_and_add(&bcache.nra, 1);
+  }
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,60 +227,113 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    blkrw(b, 0);
     b->valid = 1;
   }
   return b;
 }
 
+// Return a locked buf for the indicated block without
+// reading it from disk, for a caller that will overwrite
+// all of its contents.
+struct buf*
+bfresh(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  b->valid = 1;
+  return b;
+}
+
+// Start reading the indicated block into the cache, unless
+// it is there already, and return without waiting; bget()
+// waits for the read to finish before handing out the buf.
+// Does nothing if too much that was read ahead is unused.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if(bcache.nra >= MAXRA)
+    return;
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+  b->valid = 1;  // once the disk is done
+  blksubmit(b, 0);
+  brelse(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  blkrw(b, 1);
+}
+
+// Start writing b's contents to disk, without waiting, so
+// that the caller can start more.  b must stay locked until
+// bwait(b) returns.
+void
+bwritestart(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwritestart");
+  blksubmit(b, 1);
+}
+
+// Wait for a write started by bwritestart() to finish.
+void
+bwait(struct buf *b)
+{
+  blkwait(b);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Move to the head of its bucket's most-recently-used list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // b can't change buckets while we hold a reference.
+  bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bunlink(b);
+    bpush(bk, b);
   }
   
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 
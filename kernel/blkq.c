@@ -0,0 +1,198 @@
+// Block I/O queue, between the buffer cache and the disk driver.
+//
+// Requests wait here, sorted by block number, until the disk has
+// descriptors free for them.  Each dispatch takes the oldest
+// read if its deadline has passed, else the oldest write if its
+// deadline has passed, else the next read in elevator order
+// (ascending block numbers from the last dispatch, wrapping
+// around), else the next write.  So reads go first, but writes
+// can't starve.  The dispatched block is merged with queued
+// requests in the same direction for the blocks after it, up
+// to NBIOSEG, into one multi-segment disk request.
+//
+// While the queue is plugged, new requests wait so that a batch
+// of them can be merged.  blkunplug(), blkwait() and disk
+// completions dispatch them.
+//
+// Interface:
+// * blksubmit() queues a buf and returns.
+// * blkwait() waits for the disk to finish with it.
+// * blkrw() does both.
+// * blkplug() and blkunplug() bracket a batch of blksubmit()s.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "blkstat.h"
+
+#define READEXPIRE  (TIMEBASE/20)  // reads should start within 50ms
+#define WRITEEXPIRE (TIMEBASE/2)   // and writes within 500ms
+
+struct {
+  struct spinlock lock;
+  struct buf *head;   // queued bufs, sorted by blockno, through qnext
+  int n;              // number queued
+  uint next;          // elevator position: block after the last dispatch
+  int plugged;
+  struct blkstat st;
+} blkq;
+
+void
+blkinit(void)
+{
+  initlock(&blkq.lock, "blkq");
+}
+
+static int
+expired(struct buf *b, uint64 now)
+{
+  return now - b->qtime >= (b->qwrite ? WRITEEXPIRE : READEXPIRE);
+}
+
+// Choose the next buf to dispatch, as described above.
+// Returns the link that points to it, or 0 if none is queued.
+static struct buf**
+pick(uint64 now)
+{
+  struct buf **pp, **old[2], **next[2], **first[2];
+  struct buf *b;
+  int w;
+
+  old[0] = old[1] = next[0] = next[1] = first[0] = first[1] = 0;
+  for(pp = &blkq.head; (b = *pp) != 0; pp = &b->qnext){
+    w = b->qwrite;
+    if(old[w] == 0 || b->qtime < (*old[w])->qtime)
+      old[w] = pp;
+    if(first[w] == 0)
+      first[w] = pp;
+    if(next[w] == 0 && b->blockno >= blkq.next)
+      next[w] = pp;
+  }
+  for(w = 0; w < 2; w++)
+    if(old[w] && expired(*old[w], now))
+      return old[w];
+  for(w = 0; w < 2; w++)
+    if(first[w])
+      return next[w] ? next[w] : first[w];
+  return 0;
+}
+
+// Send queued requests to the disk until it has no room.
+// Caller must hold blkq.lock.
+static void
+dispatch(void)
+{
+  struct buf **pp, *b, *bs[NBIOSEG];
+  uint64 now;
+  int n, started;
+
+  now = r_time();
+  started = 0;
+  while((pp = pick(now)) != 0){
+    // the bufs for the next blocks follow in the list.
+    bs[0] = *pp;
+    for(n = 1, b = bs[0]->qnext; n < NBIOSEG && b; n++, b = b->qnext){
+      if(b->dev != bs[0]->dev || b->blockno != bs[0]->blockno + n || b->qwrite != bs[0]->qwrite)
+        break;
+      bs[n] = b;
+    }
+    if(virtio_disk_start(bs, n, bs[0]->qwrite) < 0)
+      break;  // virtio_disk_intr() will call blkkick()
+    *pp = bs[n-1]->qnext;
+    blkq.n -= n;
+    blkq.next = bs[n-1]->blockno + 1;
+    blkq.st.nreq++;
+    blkq.st.nmerged += n - 1;
+    if(expired(bs[0], now))
+      blkq.st.nlate++;
+    started = 1;
+  }
+  // one notification for the lot.
+  if(started)
+    virtio_disk_notify();
+}
+
+// Queue a read (write == 0) or write of b, and start it
+// unless the queue is plugged.  b must stay locked until
+// blkwait(b) returns, except that a read ahead is unlocked
+// at once, since bget() waits for b->disk.
+void
+blksubmit(struct buf *b, int write)
+{
+  struct buf **pp;
+
+  acquire(&blkq.lock);
+  b->disk = 1;
+  b->qwrite = write;
+  b->qtime = r_time();
+  for(pp = &blkq.head; *pp && (*pp)->blockno < b->blockno; pp = &(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+  blkq.n++;
+  blkq.st.nbuf++;
+  if(blkq.n > blkq.st.maxqueue)
+    blkq.st.maxqueue = blkq.n;
+  if(!blkq.plugged)
+    dispatch();
+  release(&blkq.lock);
+}
+
+// Send whatever the disk has room for.
+// Called by virtio_disk_intr() when requests finish.
+void
+blkkick(void)
+{
+  acquire(&blkq.lock);
+  dispatch();
+  release(&blkq.lock);
+}
+
+// Wait for the disk to finish with b, first sending it
+// in case the queue is plugged.
+void
+blkwait(struct buf *b)
+{
+  blkkick();
+  virtio_disk_wait(b);
+}
+
+void
+blkrw(struct buf *b, int write)
+{
+  blksubmit(b, write);
+  blkwait(b);
+}
+
+// Hold back new requests until blkunplug().
+void
+blkplug(void)
+{
+  acquire(&blkq.lock);
+  blkq.plugged++;
+  release(&blkq.lock);
+}
+
+void
+blkunplug(void)
+{
+  acquire(&blkq.lock);
+  if(--blkq.plugged == 0)
+    dispatch();
+  release(&blkq.lock);
+}
+
+void
+blkstat(struct blkstat *st)
+{
+  acquire(&blkq.lock);
+  *st = blkq.st;
+  virtio_disk_stat(st);
+  release(&blkq.lock);
+}
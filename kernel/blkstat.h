@@ -0,0 +1,17 @@
+// lat[k] counts waits for a buf that ended 2^k up to 2^(k+1)
+// microseconds after it was sent to the disk; lat[0] also
+// counts quicker ones, and lat[NLAT-1] slower ones.
+#define NLAT 16
+
+struct blkstat {
+  uint64 nbuf;     // Blocks queued for reading or writing
+  uint64 nreq;     // Disk requests they were sent in
+  uint64 nmerged;  // Blocks that joined another block's request
+  uint64 nlate;    // Requests sent after their deadline
+  uint64 nintr;    // Disk interrupts
+  uint64 nnotify;  // Notifications sent to the disk
+  uint64 npolled;  // Requests found finished by polling
+  uint64 poll;     // Microseconds to poll for, or 0 for interrupts only
+  uint64 lat[NLAT];  // Wait latency histogram
+  int maxqueue;    // Most blocks ever waiting in the queue
+};
@@ -0,0 +1,141 @@
+// Binary buddy allocator for physical memory.
+//
+// Hands out blocks of 2^k contiguous pages, for 0 <= k < NORDER.
+// A free block of order k starts at a page whose index (counted
+// from KERNBASE) is a multiple of 2^k; its buddy is the block
+// whose index differs only in bit k.  buddyalloc() splits a larger
+// block when there is no free block of the wanted order, and
+// buddyfree() merges a block with its buddy, repeatedly, while the
+// buddy is free too.
+//
+// kalloc() keeps per-CPU lists of single pages on top of this;
+// see kalloc.c.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PG2PA(i) ((void*)(KERNBASE + (uint64)(i) * PGSIZE))
+
+// a free block; linked into its order's list.
+struct block {
+  struct block *next;
+  struct block *prev;
+};
+
+struct {
+  struct spinlock lock;
+  struct block free[NORDER];  // list heads, circular
+  int nfree[NORDER];          // number of blocks on each list
+  uint64 nsplit;
+  uint64 nmerge;
+} buddy;
+
+// order+1 if page i starts a free block, else 0.
+static char freeorder[NPAGE];
+
+void
+buddyinit(void)
+{
+  initlock(&buddy.lock, "buddy");
+  for(int k = 0; k < NORDER; k++)
+    buddy.free[k].next = buddy.free[k].prev = &buddy.free[k];
+}
+
+static void
+bpush(struct block *b, int k)
+{
+  b->next = buddy.free[k].next;
+  b->prev = &buddy.free[k];
+  b->next->prev = b;
+  buddy.free[k].next = b;
+  buddy.nfree[k]++;
+  freeorder[PA2PG(b)] = k + 1;
+}
+
+static void
+bremove(struct block *b, int k)
+{
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+  buddy.nfree[k]--;
+  freeorder[PA2PG(b)] = 0;
+}
+
+// Allocate 2^order contiguous pages.
+// Returns a pointer that the kernel can use, aligned to
+// 2^order pages, or 0 if there is no such block.
+// The contents are undefined.
+void*
+buddyalloc(int order)
+{
+  struct block *b;
+  int k;
+
+  if(order < 0 || order >= NORDER)
+    return 0;
+
+  acquire(&buddy.lock);
+  for(k = order; k < NORDER; k++)
+    if(buddy.nfree[k] > 0)
+      break;
+  if(k == NORDER){
+    release(&buddy.lock);
+    return 0;
+  }
+  b = buddy.free[k].next;
+  bremove(b, k);
+  // give back the upper halves.
+  while(k > order){
+    k--;
+    bpush((struct block*)((char*)b + ((uint64)PGSIZE << k)), k);
+    buddy.nsplit++;
+  }
+  release(&buddy.lock);
+  return (void*)b;
+}
+
+// Free the 2^order pages at pa, which must have come
+// from buddyalloc(order) (or be free memory, at boot).
+void
+buddyfree(void *pa, int order)
+{
+  uint64 i, b;
+
+  if(order < 0 || order >= NORDER ||
+     ((uint64)pa % ((uint64)PGSIZE << order)) != 0 ||
+     (uint64)pa < KERNBASE || (uint64)pa >= PHYSTOP)
+    panic("buddyfree");
+
+  i = PA2PG(pa);
+  acquire(&buddy.lock);
+  for(; order < NORDER - 1; order++){
+    b = i ^ (1L << order);
+    if(b >= NPAGE || freeorder[b] != order + 1)
+      break;
+    bremove(PG2PA(b), order);
+    buddy.nmerge++;
+    if(b < i)
+      i = b;
+  }
+  bpush(PG2PA(i), order);
+  release(&buddy.lock);
+}
+
+// Fill in the buddy allocator's part of *st.
+void
+buddystat(struct memstat *st)
+{
+  acquire(&buddy.lock);
+  for(int k = 0; k < NORDER; k++)
+    st->nfree[k] = buddy.nfree[k];
+  st->nsplit = buddy.nsplit;
+  st->nmerge = buddy.nmerge;
+  release(&buddy.lock);
+}
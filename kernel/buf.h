@@ -7,6 +7,11 @@ struct buf {
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *qnext; // block I/O queue, sorted by blockno
+  int qwrite;        // queued to be written, not read?
+  uint64 qtime;      // when queued, for its deadline
+  uint64 dtime;      // when sent to the disk, for its latency
+  int ra;            // read ahead, and not used since?
   uchar data[BSIZE];
 };
 
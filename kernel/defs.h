@@ -1,22 +1,49 @@
+struct blkstat;
 struct buf;
 struct context;
+struct dirent;
 struct file;
 struct inode;
+struct iovec;
+struct kcache;
+struct lockstat;
+struct memstat;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct vma;
 struct stat;
 struct superblock;
 
+// blkq.c
+void            blkinit(void);
+void            blksubmit(struct buf*, int);
+void            blkkick(void);
+void            blkwait(struct buf*);
+void            blkrw(struct buf*, int);
+void            blkplug(void);
+void            blkunplug(void);
+void            blkstat(struct blkstat*);
+
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bfresh(uint, uint);
+void            bprefetch(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritestart(struct buf*);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
+// buddy.c
+void            buddyinit(void);
+void*           buddyalloc(int);
+void            buddyfree(void *, int);
+void            buddystat(struct memstat*);
+
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
@@ -33,11 +60,19 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filesplice(struct file*, struct file*, int);
+int             filegetdents(struct file*, uint64, int, int);
+int             filepread(struct file*, uint64, int n, uint64);
+int             filepwrite(struct file*, uint64, int n, uint64);
+int64           fileseek(struct file*, int64, int);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+int             dirread(struct inode*, uint64*, struct dirent*, struct inode**, int);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
@@ -48,10 +83,11 @@ void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
+struct inode*   nameiat(struct inode*, char*);
 struct inode*   nameiparent(char*, char*);
-int             readi(struct inode*, int, uint64, uint, uint);
+int             readi(struct inode*, int, uint64, uint64, uint);
 void            stati(struct inode*, struct stat*);
-int             writei(struct inode*, int, uint64, uint, uint);
+int             writei(struct inode*, int, uint64, uint64, uint);
 void            itrunc(struct inode*);
 
 // ramdisk.c
@@ -63,6 +99,9 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kref(void *);
+int             krefcnt(void *);
+void            kstat(struct memstat*);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -70,11 +109,25 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+struct vma*     findvma(struct proc*, uint64);
+uint64          mmapbase(struct proc*);
+uint64          mmap(uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+int             mmapfault(struct proc*, struct vma*, uint64, int);
+void            mmapprefault(struct proc*, uint64, uint64);
+void            mmapexit(struct proc*);
+int             mmapshare(struct proc*);
+int             mmapfork(struct proc*, struct proc*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             pipesplicein(struct pipe*, struct file*, int);
+int             pipespliceout(struct pipe*, struct file*, int);
+int             pipereadv(struct pipe*, struct iovec*, int, int);
+int             pipewritev(struct pipe*, struct iovec*, int, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -100,6 +153,7 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeupone(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -113,10 +167,19 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            freelock(struct spinlock*);
+void            lockstat(char*, struct lockstat*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// slab.c
+struct kcache*  kcachecreate(char*, uint);
+void*           kcachealloc(struct kcache*);
+void            kcachefree(struct kcache*, void*);
+int             kcacheshrink(void);
+int             kcachepages(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -132,6 +195,12 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// strbench.c
+void            strbench(void);
+
+// diskbench.c
+void            diskbench(void);
+
 // syscall.c
 int             argint(int, int*);
 int             argstr(int, char*, int);
@@ -163,11 +232,15 @@ pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, uint64, int);
+int             cowfault(pagetable_t, uint64);
+int             vmfault(struct proc*, uint64, int);
+void            vmprefault(struct proc*, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
+pte_t*          walk(pagetable_t, uint64, int);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
@@ -180,8 +253,12 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
+int             virtio_disk_start(struct buf **, int, int);
+void            virtio_disk_notify(void);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
+void            virtio_disk_stat(struct blkstat*);
+uint64          virtio_disk_setpoll(uint64);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
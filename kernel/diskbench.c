@@ -0,0 +1,75 @@
+//
+// Boot-time benchmark of the virtio disk, run when the kernel
+// is built with make DISKBENCH=1.  Reads random blocks keeping
+// 1, 2, 4, ... requests in flight, up to as many as the ring
+// holds, and prints reads per second at each queue depth,
+// and how many interrupts and notifications they took.
+// It must run in a process, since it sleeps.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "virtio.h"
+#include "blkstat.h"
+
+#define NREAD    2000      // reads at each depth
+#define MAXDEPTH NUM       // beyond NUM/3, only with indirect descriptors
+
+void
+diskbench(void)
+{
+  static struct buf *bufs[MAXDEPTH];
+  struct buf *b;
+  struct blkstat st0, st;
+  uint64 t, seed;
+  int depth, i;
+
+  // private bufs, not in the cache; only ever read into.
+  for(i = 0; i < MAXDEPTH; i++){
+    if((b = kalloc()) == 0)
+      panic("diskbench");
+    memset(b, 0, sizeof(*b));
+    initsleeplock(&b->lock, "diskbench");
+    b->dev = ROOTDEV;
+    bufs[i] = b;
+  }
+
+  printf("diskbench: random reads per second\n");
+  seed = 1;
+  for(depth = 1; ; depth *= 2){
+    if(depth > MAXDEPTH)
+      depth = MAXDEPTH;
+    blkstat(&st0);
+    t = r_time();
+    for(i = 0; i < NREAD; i++){
+      // reuse the buf of the oldest request once it is done.
+      b = bufs[i % depth];
+      if(i >= depth)
+        blkwait(b);
+      seed = seed * 1103515245 + 12345;
+      b->blockno = (seed >> 16) % FSSIZE;
+      blksubmit(b, 0);
+    }
+    for(i = 0; i < depth; i++)
+      blkwait(bufs[i]);
+    t = r_time() - t;
+    blkstat(&st);
+    if(t == 0)
+      t = 1;
+    printf("  depth %d: %d, %d interrupts, %d notifications\n", depth,
+           (int)((uint64)NREAD * TIMEBASE / t),
+           (int)(st.nintr - st0.nintr), (int)(st.nnotify - st0.nnotify));
+    if(depth == MAXDEPTH)
+      break;
+  }
+
+  for(i = 0; i < MAXDEPTH; i++)
+    kfree(bufs[i]);
+}
@@ -12,17 +12,21 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kcache *cache;  // file structures come from here
+  int nfile;             // number allocated, at most NFILE
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kcachecreate("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -32,15 +36,22 @@ filealloc(void)
   struct file *f;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.nfile == NFILE){
+    release(&ftable.lock);
+    return 0;
   }
+  ftable.nfile++;
   release(&ftable.lock);
-  return 0;
+
+  if((f = kcachealloc(ftable.cache)) == 0){
+    acquire(&ftable.lock);
+    ftable.nfile--;
+    release(&ftable.lock);
+    return 0;
+  }
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +80,9 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
+  ftable.nfile--;
   release(&ftable.lock);
+  kcachefree(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -101,27 +112,131 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
+// Total length of the iovcnt segments in iov, or -1 if there
+// are too many of them or they add up to more than an int.
+static int
+iovtotal(struct iovec *iov, int iovcnt)
+{
+  uint64 n;
+  int k;
+
+  if(iovcnt < 0 || iovcnt > IOV_MAX)
+    return -1;
+  n = 0;
+  for(k = 0; k < iovcnt; k++){
+    if(iov[k].iov_len > 0x7fffffff - n)
+      return -1;
+    n += iov[k].iov_len;
+  }
+  return n;
+}
+
+static void
+iovprefault(struct iovec *iov, int iovcnt)
+{
+  int k;
+
+  for(k = 0; k < iovcnt; k++)
+    vmprefault(myproc(), (uint64)iov[k].iov_base, iov[k].iov_len);
+}
+
+// Read into the user segments iov from inode file f at *off,
+// advancing *off, until they are full or the file ends.
+static int
+readinode(struct file *f, struct iovec *iov, int iovcnt, uint64 *off)
+{
+  int k, r, tot;
+
+  tot = 0;
+  ilock(f->ip);
+  for(k = 0; k < iovcnt; k++){
+    if((r = readi(f->ip, 1, (uint64)iov[k].iov_base, *off, iov[k].iov_len)) < 0){
+      tot = -1;
+      break;
+    }
+    *off += r;
+    tot += r;
+    if(r < iov[k].iov_len)
+      break;
+  }
+  iunlock(f->ip);
+  return tot;
+}
+
+// Write the n bytes of the user segments iov to inode file f
+// at *off, advancing *off.
+static int
+writeinode(struct file *f, struct iovec *iov, int iovcnt, int n, uint64 *off)
+{
+  int r, i, n1, max, tot, seg;
+  uint64 done;
+
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  // the segments land back to back in the file, so
+  // a transaction can take as many as add up to max.
+  max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  i = 0;
+  seg = 0;
+  done = 0;  // bytes of iov[seg] written
+  r = n1 = 0;
+  while(i < n){
+    begin_op();
+    ilock(f->ip);
+    for(tot = 0; tot < max && i < n; tot += r, i += r){
+      while(done == iov[seg].iov_len){
+        seg++;
+        done = 0;
+      }
+      n1 = max - tot;
+      if(n1 > iov[seg].iov_len - done)
+        n1 = iov[seg].iov_len - done;
+      if((r = writei(f->ip, 1, (uint64)iov[seg].iov_base + done, *off, n1)) > 0)
+        *off += r;
+      if(r != n1)
+        break;
+      done += r;
+    }
+    iunlock(f->ip);
+    end_op();
+
+    if(r != n1){
+      // error from writei
+      break;
+    }
+  }
+  return i == n ? n : -1;
+}
+
+// Read from file f into the iovcnt user segments in iov.
 int
-fileread(struct file *f, uint64 addr, int n)
+filereadv(struct file *f, struct iovec *iov, int iovcnt)
 {
-  int r = 0;
+  int k, m, n, r = 0;
 
-  if(f->readable == 0)
+  if(f->readable == 0 || (n = iovtotal(iov, iovcnt)) < 0)
     return -1;
 
+  iovprefault(iov, iovcnt);
+
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = pipereadv(f->pipe, iov, iovcnt, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    for(k = 0; k < iovcnt; k++){
+      if((m = devsw[f->major].read(1, (uint64)iov[k].iov_base, iov[k].iov_len)) < 0)
+        return r > 0 ? r : -1;
+      r += m;
+      if(m < iov[k].iov_len)
+        break;
+    }
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    r = readinode(f, iov, iovcnt, &f->off);
   } else {
     panic("fileread");
   }
@@ -129,50 +244,29 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
-// Write to file f.
-// addr is a user virtual address.
+// Write the iovcnt user segments in iov to file f.
 int
-filewrite(struct file *f, uint64 addr, int n)
+filewritev(struct file *f, struct iovec *iov, int iovcnt)
 {
-  int r, ret = 0;
+  int k, n, ret = 0;
 
-  if(f->writable == 0)
+  if(f->writable == 0 || (n = iovtotal(iov, iovcnt)) < 0)
     return -1;
 
+  iovprefault(iov, iovcnt);
+
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewritev(f->pipe, iov, iovcnt, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
-  } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
+    for(k = 0; k < iovcnt; k++){
+      if(devsw[f->major].write(1, (uint64)iov[k].iov_base, iov[k].iov_len) != iov[k].iov_len)
+        return -1;
+      ret += iov[k].iov_len;
     }
-    ret = (i == n ? n : -1);
+  } else if(f->type == FD_INODE){
+    ret = writeinode(f, iov, iovcnt, n, &f->off);
   } else {
     panic("filewrite");
   }
@@ -180,3 +274,161 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Read from file f.
+// addr is a user virtual address.
+int
+fileread(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1);
+}
+
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1);
+}
+
+// Read from inode file f at offset off, leaving f's
+// own offset alone.
+int
+filepread(struct file *f, uint64 addr, int n, uint64 off)
+{
+  struct iovec iov;
+
+  if(f->readable == 0 || f->type != FD_INODE || n < 0)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  iovprefault(&iov, 1);
+  return readinode(f, &iov, 1, &off);
+}
+
+// Write to inode file f at offset off, leaving f's
+// own offset alone.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint64 off)
+{
+  struct iovec iov;
+
+  if(f->writable == 0 || f->type != FD_INODE || n < 0)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  iovprefault(&iov, 1);
+  return writeinode(f, &iov, 1, n, &off);
+}
+
+// Set the offset of inode file f to off bytes from the
+// start, the current offset, or the end, as whence is
+// SEEK_SET, SEEK_CUR or SEEK_END.  Files have no holes,
+// so the offset may not go past the end.
+// Returns the new offset.
+int64
+fileseek(struct file *f, int64 off, int whence)
+{
+  if(f->type != FD_INODE)
+    return -1;
+
+  ilock(f->ip);
+  if(whence == SEEK_CUR)
+    off += f->off;
+  else if(whence == SEEK_END)
+    off += f->ip->size;
+  else if(whence != SEEK_SET)
+    off = -1;
+  if(off < 0 || off > f->ip->size){
+    iunlock(f->ip);
+    return -1;
+  }
+  f->off = off;
+  iunlock(f->ip);
+  return off;
+}
+
+// Move up to n bytes from file fin to file fout without
+// copying them through user space.  One must be an inode
+// and the other a pipe.
+int
+filesplice(struct file *fin, struct file *fout, int n)
+{
+  if(fin->readable == 0 || fout->writable == 0 || n < 0)
+    return -1;
+  if(fin->type == FD_INODE && fout->type == FD_PIPE)
+    return pipesplicein(fout->pipe, fin, n);
+  if(fin->type == FD_PIPE && fout->type == FD_INODE)
+    return pipespliceout(fin->pipe, fout, n);
+  return -1;
+}
+
+#define DIRBATCH 16  // entries read per lock of the directory
+
+// Read up to n entries of directory f into the struct direntplus
+// array at user address addr, filling in each entry's type, nlink
+// and size if plus is set.  Entries are read a batch at a time
+// with the directory locked, and the entries' inodes are locked
+// one by one afterwards, as namex() does.
+// Returns the number of entries read, 0 at the end, or -1 if
+// none could be copied out.
+int
+filegetdents(struct file *f, uint64 addr, int n, int plus)
+{
+  struct proc *p = myproc();
+  struct dirent de[DIRBATCH];
+  struct inode *ips[DIRBATCH];
+  struct direntplus ent[DIRBATCH];
+  struct stat st;
+  uint64 off;
+  int i, m, tot;
+
+  if(f->type != FD_INODE || f->readable == 0 || n < 0)
+    return -1;
+
+  for(tot = 0; tot < n; tot += m){
+    ilock(f->ip);
+    if(f->ip->type != T_DIR){
+      iunlock(f->ip);
+      return -1;
+    }
+    off = f->off;
+    m = dirread(f->ip, &f->off, de, plus ? ips : 0, n - tot < DIRBATCH ? n - tot : DIRBATCH);
+    iunlock(f->ip);
+    if(m == 0)
+      break;
+
+    for(i = 0; i < m; i++){
+      memset(&ent[i], 0, sizeof(ent[i]));
+      ent[i].inum = de[i].inum;
+      memmove(ent[i].name, de[i].name, DIRSIZ);
+      if(plus && ips[i]){
+        ilock(ips[i]);
+        stati(ips[i], &st);
+        iunlock(ips[i]);
+        begin_op();
+        iput(ips[i]);
+        end_op();
+        ent[i].type = st.type;
+        ent[i].nlink = st.nlink;
+        ent[i].size = st.size;
+      }
+    }
+    if(copyout(p->pagetable, addr + tot*sizeof(ent[0]), (char*)ent, m*sizeof(ent[0])) < 0){
+      // this batch is lost; leave the offset before it, and
+      // report what was copied out, as read() does.
+      ilock(f->ip);
+      f->off = off;
+      iunlock(f->ip);
+      return tot > 0 ? tot : -1;
+    }
+  }
+  return tot;
+}
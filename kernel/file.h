@@ -5,7 +5,7 @@ struct file {
   char writable;
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
-  uint off;          // FD_INODE
+  uint64 off;        // FD_INODE
   short major;       // FD_DEVICE
 };
 
@@ -18,8 +18,12 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // itable list
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ranext;        // block after the last one read
+  uint raend;         // blocks before this have been read ahead
+  uint rawin;         // readahead window, 0 if not sequential
 
   short type;         // copy of disk inode
   short major;
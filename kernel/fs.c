@@ -163,9 +163,11 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// entries, which come from a slab cache and are freed when
+// their ref drops to zero.  Since ip->dev and ip->inum
+// indicate which i-node an entry holds, one must hold
+// itable.lock while using ip->ref, ip->dev, ip->inum or
+// ip->next.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -173,31 +175,31 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kcache *cache;
+  struct inode *inode;  // entries in use, at most NINODE
+  int ninode;
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.cache = kcachecreate("inode", sizeof(struct inode));
 }
 
 static struct inode* iget(uint dev, uint inum);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if there is no memory for it.
 struct inode*
 ialloc(uint dev, short type)
 {
   int inum;
   struct buf *bp;
   struct dinode *dip;
+  struct inode *ip;
 
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
@@ -206,8 +208,12 @@ ialloc(uint dev, short type)
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
+      if((ip = iget(dev, inum)) == 0){
+        dip->type = 0;
+        log_write(bp);
+      }
       brelse(bp);
-      return iget(dev, inum);
+      return ip;
     }
     brelse(bp);
   }
@@ -239,34 +245,38 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Returns 0 if there is no memory for a new entry.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = itable.inode; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Allocate an inode entry.
+  if(itable.ninode == NINODE || (ip = kcachealloc(itable.cache)) == 0){
+    release(&itable.lock);
+    return 0;
+  }
 
-  ip = empty;
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = ip->raend = ip->rawin = 0;
+  ip->next = itable.inode;
+  itable.inode = ip;
+  itable.ninode++;
   release(&itable.lock);
 
   return ip;
@@ -323,8 +333,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry
+// is freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -332,6 +342,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp;
+
   acquire(&itable.lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
@@ -353,7 +365,14 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    for(pp = &itable.inode; *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+    itable.ninode--;
+    freelock(&ip->lock.lk);
+    kcachefree(itable.cache, ip);
+  }
   release(&itable.lock);
 }
 
@@ -448,12 +467,50 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Readahead.  Reading the block after the one last read from
+// an inode continues a sequential stream.  For a stream, the
+// rawin blocks after the one being read are read into the
+// buffer cache ahead of time, a batch at once so that they
+// merge into large disk requests.  Once half of them have been
+// used the next batch starts, and the window doubles, up to
+// RAMAX.
+#define RAMIN 4
+#define RAMAX 16
+
+// Block bn of ip is about to be read.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint end;
+
+  if(bn == ip->ranext){
+    if(ip->rawin == 0)
+      ip->rawin = RAMIN;
+  } else if(bn + 1 != ip->ranext){
+    ip->rawin = 0;  // not sequential
+    ip->raend = 0;
+  }
+  ip->ranext = bn + 1;
+  if(ip->raend < ip->ranext)
+    ip->raend = ip->ranext;
+  if(ip->rawin == 0 || ip->raend - ip->ranext > ip->rawin / 2)
+    return;
+
+  end = min(ip->ranext + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  blkplug();
+  for(; ip->raend < end; ip->raend++)
+    bprefetch(ip->dev, bmap(ip, ip->raend));
+  blkunplug();
+  ip->rawin = min(ip->rawin * 2, RAMAX);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
-readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+readi(struct inode *ip, int user_dst, uint64 dst, uint64 off, uint n)
 {
   uint tot, m;
   struct buf *bp;
@@ -464,6 +521,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    readahead(ip, off/BSIZE);
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
@@ -484,7 +542,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 // If the return value is less than the requested n,
 // there was an error of some kind.
 int
-writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+writei(struct inode *ip, int user_src, uint64 src, uint64 off, uint n)
 {
   uint tot, m;
   struct buf *bp;
@@ -526,6 +584,8 @@ namecmp(const char *s, const char *t)
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Returns 0 if not found, or if found but iget() fails;
+// callers that need to tell those apart check *poff.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
@@ -552,17 +612,46 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   return 0;
 }
 
+// Read up to n in-use entries of directory dp into de[],
+// starting at *off and advancing *off past them.
+// If ips is not 0, also return a reference to each entry's
+// inode in ips[], or 0 if there was no memory for one.
+// Caller must hold dp's lock.
+// Returns the number of entries read.
+int
+dirread(struct inode *dp, uint64 *off, struct dirent *de, struct inode **ips, int n)
+{
+  int i;
+
+  if(dp->type != T_DIR)
+    panic("dirread not DIR");
+
+  for(i = 0; i < n && *off + sizeof(*de) <= dp->size; *off += sizeof(*de)){
+    if(readi(dp, 0, (uint64)&de[i], *off, sizeof(*de)) != sizeof(*de))
+      panic("dirread read");
+    if(de[i].inum == 0)
+      continue;
+    if(ips)
+      ips[i] = iget(dp->dev, de[i].inum);
+    i++;
+  }
+  return i;
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
+  uint poff;
   struct dirent de;
   struct inode *ip;
 
   // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
+  poff = -1;
+  if((ip = dirlookup(dp, name, &poff)) != 0 || poff != -1){
+    if(ip)
+      iput(ip);
     return -1;
   }
 
@@ -622,18 +711,21 @@ skipelem(char *path, char *name)
 }
 
 // Look up and return the inode for a path name.
+// A relative path starts at dp, or at the current
+// directory if dp is 0.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
 // Must be called inside a transaction since it calls iput().
 static struct inode*
-namex(char *path, int nameiparent, char *name)
+namex(struct inode *dp, char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
 
-  if(*path == '/')
-    ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  if(*path == '/'){
+    if((ip = iget(ROOTDEV, ROOTINO)) == 0)
+      return 0;
+  } else
+    ip = idup(dp ? dp : myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -664,11 +756,19 @@ struct inode*
 namei(char *path)
 {
   char name[DIRSIZ];
-  return namex(path, 0, name);
+  return namex(0, path, 0, name);
+}
+
+// Like namei, but a relative path starts at directory dp.
+struct inode*
+nameiat(struct inode *dp, char *path)
+{
+  char name[DIRSIZ];
+  return namex(dp, path, 0, name);
 }
 
 struct inode*
 nameiparent(char *path, char *name)
 {
-  return namex(path, 1, name);
+  return namex(0, path, 1, name);
 }
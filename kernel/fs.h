@@ -58,3 +58,12 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entry as returned by getdents(), with the type,
+// link count and size of its inode.  Not stored on disk.
+struct direntplus {
+  ushort inum;
+  char name[DIRSIZ];
+  short type;
+  short nlink;
+  uint size;
+};
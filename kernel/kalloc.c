@@ -1,6 +1,19 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Free memory lives in the buddy allocator (buddy.c), which
+// can also hand out larger contiguous blocks.  Each CPU keeps
+// its own list of single pages in front of it, with its own
+// lock, so CPUs allocating and freeing at the same time don't
+// contend: a list that runs dry is refilled with a batch of
+// pages from the buddy allocator (or, if that is empty, from
+// another CPU's list), and a list that grows too long gives a
+// batch back, so that the pages can merge again.
+// Small kernel objects come from slab.c, on top of kalloc().
+//
+// Pages shared copy-on-write after fork() have a reference
+// count; kfree() only frees a page when its count drops to zero.
 
 #include "types.h"
 #include "param.h"
@@ -8,6 +21,7 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "memstat.h"
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -18,48 +32,195 @@ struct run {
   struct run *next;
 };
 
-struct {
+#define KBATCHORDER 5                 // refill with 2^KBATCHORDER pages
+#define KBATCH (1 << KBATCHORDER)
+#define KHIGH  (2 * KBATCH)           // give back a batch above this
+#define KSTEAL KBATCH  // max pages to steal from another CPU at once
+
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;           // length of freelist; read without the lock as a hint
+};
+
+struct kmem kmem[NCPU];
+
+// reference counts of allocated pages, updated atomically.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+static int refcnt[(PHYSTOP - KERNBASE) / PGSIZE];
+
+static void kpush(struct kmem *km, void *pa);
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  buddyinit();
   freerange(end, (void*)PHYSTOP);
 }
 
+// Give the pages in [pa_start, pa_end) to the buddy allocator.
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
+
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    memset(p, 1, PGSIZE);
+    buddyfree(p, 0);
+  }
+}
+
+// Put page pa on km's free list.
+static void
+kpush(struct kmem *km, void *pa)
+{
+  struct run *r = (struct run*)pa;
+
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  release(&km->lock);
+}
+
+// Get a batch of pages from the buddy allocator for CPU id's
+// list, and return one of them.  Takes a smaller block if
+// there's no block of KBATCH pages left.
+static struct run*
+krefill(int id)
+{
+  struct kmem *km = &kmem[id];
+  struct run *first, *r;
+  char *p;
+  int k, n;
+
+  for(k = KBATCHORDER; k >= 0; k--)
+    if((p = buddyalloc(k)) != 0)
+      break;
+  if(k < 0)
+    return 0;
+
+  n = 1 << k;
+  first = (struct run*)p;
+  if(n > 1){
+    for(int i = 1; i < n - 1; i++)
+      ((struct run*)(p + i*PGSIZE))->next = (struct run*)(p + (i+1)*PGSIZE);
+    r = (struct run*)(p + (n-1)*PGSIZE);
+    acquire(&km->lock);
+    r->next = km->freelist;
+    km->freelist = (struct run*)(p + PGSIZE);
+    km->nfree += n - 1;
+    release(&km->lock);
+  }
+  return first;
+}
+
+// Give KBATCH pages of km's list back to the buddy allocator
+// if the list has grown longer than KHIGH.
+static void
+kdrain(struct kmem *km)
+{
+  struct run *first, *r;
+  int n;
+
+  acquire(&km->lock);
+  if(km->nfree <= KHIGH){
+    release(&km->lock);
+    return;
+  }
+  first = km->freelist;
+  for(n = 1, r = first; n < KBATCH; n++)
+    r = r->next;
+  km->freelist = r->next;
+  r->next = 0;
+  km->nfree -= KBATCH;
+  release(&km->lock);
+
+  while(first){
+    r = first->next;
+    buddyfree(first, 0);
+    first = r;
+  }
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Move up to KSTEAL pages from the longest other CPU's
+// free list to CPU id's list, and return one of them.
+// Holds only one kmem lock at a time.
+static struct run*
+ksteal(int id)
+{
+  struct kmem *victim, *km;
+  struct run *first, *last, *r;
+  int i, n, most;
+
+  victim = 0;
+  most = 0;
+  for(i = 0; i < NCPU; i++){
+    if(i != id && kmem[i].nfree > most){
+      most = kmem[i].nfree;
+      victim = &kmem[i];
+    }
+  }
+  if(victim == 0)
+    return 0;
+
+  acquire(&victim->lock);
+  first = victim->freelist;
+  last = 0;
+  for(n = 0, r = first; r && n < KSTEAL; n++, r = r->next)
+    last = r;
+  if(last){
+    victim->freelist = last->next;
+    last->next = 0;
+  }
+  victim->nfree -= n;
+  release(&victim->lock);
+  if(first == 0)
+    return 0;
+
+  // keep the first page, put the rest on our own list.
+  if(first->next){
+    km = &kmem[id];
+    acquire(&km->lock);
+    last->next = km->freelist;
+    km->freelist = first->next;
+    km->nfree += n - 1;
+    release(&km->lock);
+  }
+  return first;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator;
+// see kinit above.)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct kmem *km;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(&refcnt[PA2REF(pa)], 1);
+  if(n > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
-  r = (struct run*)pa;
-
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  km = &kmem[cpuid()];
+  kpush(km, pa);
+  kdrain(km);
+  pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +230,61 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem *km;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+ again:
+  push_off();
+  id = cpuid();
+  km = &kmem[id];
+  acquire(&km->lock);
+  r = km->freelist;
+  if(r){
+    km->freelist = r->next;
+    km->nfree--;
+  }
+  release(&km->lock);
+  if(r == 0)
+    r = krefill(id);
+  if(r == 0)
+    r = ksteal(id);
+  pop_off();
+  // last resort: free objects cached by the slab allocator.
+  if(r == 0 && kcacheshrink() > 0)
+    goto again;
 
-  if(r)
+  if(r){
+    refcnt[PA2REF(r)] = 1;
     memset((char*)r, 5, PGSIZE); // fill with junk
+  }
   return (void*)r;
 }
+
+// Take another reference to allocated page pa,
+// e.g. to share it copy-on-write.
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+  if(__sync_fetch_and_add(&refcnt[PA2REF(pa)], 1) < 1)
+    panic("kref: free page");
+}
+
+// Return the number of references to allocated page pa.
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(&refcnt[PA2REF(pa)], __ATOMIC_SEQ_CST);
+}
+
+// Fill in *st with free memory statistics.
+void
+kstat(struct memstat *st)
+{
+  buddystat(st);
+  st->nslab = kcachepages();
+  st->ncached = 0;
+  for(int i = 0; i < NCPU; i++)
+    st->ncached += kmem[i].nfree;
+}
@@ -0,0 +1,5 @@
+struct lockstat {
+  int nlock;          // Number of locks with the given name
+  uint64 nacquire;    // Total acquire() calls on them
+  uint64 nspin;       // Total failed test-and-sets while acquiring
+};
@@ -28,7 +28,11 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous: commit() waits for all the
+// log block writes, started LOGBATCH at a time, before it
+// writes the header.
+
+#define LOGBATCH 10  // block writes in flight at once during commit
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -64,21 +68,31 @@ initlog(int dev, struct superblock *sb)
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// LOGBATCH writes at a time.
 static void
 install_trans(int recovering)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  struct buf *dbuf[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail < LOGBATCH ? log.lh.n - tail : LOGBATCH;
+    blkplug();  // so that adjacent blocks are merged
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(log.dev, log.start+tail+i+1); // read log block
+      dbuf[i] = bfresh(log.dev, log.lh.block[tail+i]); // dst, overwritten
+      memmove(dbuf[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      bwritestart(dbuf[i]);  // write dst to disk
+      brelse(lbuf);
+    }
+    blkunplug();
+    for (i = 0; i < n; i++) {
+      bwait(dbuf[i]);
+      if(recovering == 0)
+        bunpin(dbuf[i]);
+      brelse(dbuf[i]);
+    }
   }
 }
 
@@ -174,19 +188,30 @@ end_op(void)
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log, LOGBATCH
+// writes at a time.  The log blocks are about to be
+// overwritten, so they are not read first.
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  struct buf *to[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail < LOGBATCH ? log.lh.n - tail : LOGBATCH;
+    blkplug();  // the log blocks are adjacent, so one request
+    for (i = 0; i < n; i++) {
+      to[i] = bfresh(log.dev, log.start+tail+i+1); // log block
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      bwritestart(to[i]);  // write the log
+      brelse(from);
+    }
+    blkunplug();
+    for (i = 0; i < n; i++) {
+      bwait(to[i]);
+      brelse(to[i]);
+    }
   }
 }
 
@@ -25,9 +25,14 @@ main()
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    blkinit();       // block I/O queue
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe cache
     virtio_disk_init(); // emulated hard disk
+#ifdef STRBENCH
+    strbench();      // time memset(), memmove(), memcmp()
+#endif
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
@@ -21,6 +21,9 @@
 #define UART0 0x10000000L
 #define UART0_IRQ 10
 
+// r_time() counts this many ticks per second.
+#define TIMEBASE 10000000
+
 // virtio mmio interface
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
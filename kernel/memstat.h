@@ -0,0 +1,9 @@
+#define NORDER 11  // buddy block sizes: 2^0 .. 2^(NORDER-1) pages
+
+struct memstat {
+  int nfree[NORDER];  // Free buddy blocks of each order
+  int ncached;        // Free pages on kalloc()'s per-CPU lists
+  int nslab;          // Pages used by the slab allocator
+  uint64 nsplit;      // Blocks split in two by buddyalloc()
+  uint64 nmerge;      // Blocks merged with their buddy by buddyfree()
+};
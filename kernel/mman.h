@@ -0,0 +1,10 @@
+// mmap() protections
+#define PROT_NONE     0x0
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define PROT_EXEC     0x4
+
+// mmap() flags
+#define MAP_SHARED    0x01  // writes are shared, and reach the file
+#define MAP_PRIVATE   0x02  // writes are private to the process
+#define MAP_ANONYMOUS 0x20  // zero-filled memory, not a file
@@ -0,0 +1,384 @@
+//
+// Memory-mapped files and anonymous memory: mmap() and munmap().
+//
+// Each process has NVMA slots describing its mapped regions.
+// Regions are placed top-down below the trapframe, above the
+// heap.  No page is allocated or read when a region is mapped;
+// vmfault() calls mmapfault() on first touch.
+//
+// MAP_PRIVATE pages are the process's own (shared copy-on-write
+// after fork()).  MAP_SHARED pages are shared with fork()ed
+// children; for a file, pages are mapped read-only until
+// written, so that only pages marked PTE_DIRTY are written
+// back through the log by munmap(), exec() and exit().
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "mman.h"
+
+// Return the region of p containing va, or 0.
+struct vma*
+findvma(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Lowest address used by p's mapped regions;
+// the heap may not grow past it.
+uint64
+mmapbase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = TRAPFRAME;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Does [a, a+len) overlap any of p's regions?
+static int
+overlaps(struct proc *p, uint64 a, uint64 len)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && a < v->addr + v->len && v->addr < a + len)
+      return 1;
+  return 0;
+}
+
+// Find the highest free range of len bytes below TRAPFRAME
+// and above the heap.  Returns 0 if there is none.
+static uint64
+findspace(struct proc *p, uint64 len)
+{
+  struct vma *v;
+  uint64 a, best, floor;
+
+  floor = PGROUNDUP(p->sz);
+  best = 0;
+  // a region can only end at TRAPFRAME or where another begins.
+  if(len <= TRAPFRAME - floor && !overlaps(p, TRAPFRAME - len, len))
+    best = TRAPFRAME - len;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 || v->addr < floor + len)
+      continue;
+    a = v->addr - len;
+    if(a > best && !overlaps(p, a, len))
+      best = a;
+  }
+  return best;
+}
+
+// Map len bytes of f starting at offset off (or anonymous
+// memory if flags has MAP_ANONYMOUS) into the current process.
+// Returns the address of the mapping, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *fv;
+  uint64 addr;
+
+  if(len == 0 || len > TRAPFRAME || (off % PGSIZE) != 0)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if(flags & MAP_ANONYMOUS){
+    f = 0;
+    off = 0;
+  } else {
+    if(f == 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  len = PGROUNDUP(len);
+
+  fv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0){
+      fv = v;
+      break;
+    }
+  }
+  if(fv == 0 || (addr = findspace(p, len)) == 0)
+    return -1;
+
+  fv->addr = addr;
+  fv->len = len;
+  fv->prot = prot;
+  fv->flags = flags;
+  fv->f = f ? filedup(f) : 0;
+  fv->off = off;
+  return addr;
+}
+
+// Handle a page fault at va in region v of process p.
+// Returns 0 if the access can be retried, -1 if it is an error.
+int
+mmapfault(struct proc *p, struct vma *v, uint64 va, int write)
+{
+  pte_t *pte;
+  char *mem;
+  int perm, r;
+
+  va = PGROUNDDOWN(va);
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+  if(!write && (v->prot & (PROT_READ|PROT_WRITE|PROT_EXEC)) == 0)
+    return -1;
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(!write)
+      return -1;
+    if(*pte & PTE_COW)
+      return cowfault(p->pagetable, va);
+    if((*pte & PTE_W) == 0){
+      // first write to a clean shared file page.
+      *pte |= PTE_W | PTE_DIRTY;
+      return 0;
+    }
+    return -1;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(v->f){
+    ilock(v->f->ip);
+    r = readi(v->f->ip, 0, (uint64)mem, v->off + (va - v->addr), PGSIZE);
+    iunlock(v->f->ip);
+    if(r < 0){
+      kfree(mem);
+      return -1;
+    }
+  }
+
+  perm = PTE_U | PTE_R;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(v->prot & PROT_WRITE){
+    if(v->f && (v->flags & MAP_SHARED)){
+      // track which pages munmap() has to write back.
+      if(write)
+        perm |= PTE_W | PTE_DIRTY;
+    } else {
+      perm |= PTE_W;
+    }
+  }
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Read in any not yet present file pages of p's regions
+// in [va, va+len); see vmprefault().
+void
+mmapprefault(struct proc *p, uint64 va, uint64 len)
+{
+  struct vma *v;
+  uint64 a, lo, hi;
+  pte_t *pte;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 || v->f == 0)
+      continue;
+    lo = va > v->addr ? va : v->addr;
+    hi = va + len < v->addr + v->len ? va + len : v->addr + v->len;
+    for(a = PGROUNDDOWN(lo); a < hi; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        mmapfault(p, v, a, 0);
+    }
+  }
+}
+
+// Write the dirty pages of [va, va+len) in region v of p
+// back to the file, a few blocks per log transaction,
+// as filewrite() does.  Never extends the file.
+static void
+writeback(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  struct inode *ip = v->f->ip;
+  uint64 a, pa, off, n, i, n1;
+  pte_t *pte;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_DIRTY) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    off = v->off + (a - v->addr);
+    for(i = 0; i < PGSIZE; i += n1){
+      begin_op();
+      ilock(ip);
+      n = 0;
+      if(off + i < ip->size)
+        n = ip->size - (off + i);
+      n1 = PGSIZE - i;
+      if(n1 > max)
+        n1 = max;
+      if(n < n1)
+        n1 = n;
+      if(n1 > 0)
+        writei(ip, 0, pa + i, off + i, n1);
+      iunlock(ip);
+      end_op();
+      if(n1 == 0)
+        break;
+    }
+    *pte &= ~PTE_DIRTY;
+  }
+}
+
+// Unmap [addr, addr+len) of region v of p, writing dirty
+// shared pages back first.  Splits v if the range is in
+// the middle of it.  Returns 0 on success, -1 if there
+// is no free slot for the split.
+static int
+vmaunmap(struct proc *p, struct vma *v, uint64 addr, uint64 len)
+{
+  struct vma *nv;
+  uint64 end = addr + len, vend = v->addr + v->len;
+
+  if(addr > v->addr && end < vend){
+    for(nv = p->vma; nv < &p->vma[NVMA]; nv++)
+      if(nv->len == 0)
+        break;
+    if(nv == &p->vma[NVMA])
+      return -1;
+    *nv = *v;
+    nv->addr = end;
+    nv->len = vend - end;
+    nv->off = v->off + (end - v->addr);
+    if(nv->f)
+      filedup(nv->f);
+    v->len = end - v->addr;
+  }
+
+  if(v->f && (v->flags & MAP_SHARED))
+    writeback(p, v, addr, len);
+  uvmunmap(p->pagetable, addr, len / PGSIZE, 1);
+
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0){
+    if(v->f)
+      fileclose(v->f);
+    v->f = 0;
+    v->addr = 0;
+  }
+  return 0;
+}
+
+// Unmap the pages of [addr, addr+len) of the current process,
+// which must lie within one mapped region.
+// Returns 0 on success, -1 on failure.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if((addr % PGSIZE) != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if((v = findvma(p, addr)) == 0 || addr + len > v->addr + v->len)
+    return -1;
+  return vmaunmap(p, v, addr, len);
+}
+
+// Unmap all of p's regions, at exit() or exec().
+void
+mmapexit(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len)
+      vmaunmap(p, v, v->addr, v->len);
+}
+
+// Fault in every page of p's MAP_SHARED regions, before fork()
+// shares them with a child, else parent and child would each
+// fault in their own copy.  Reading a file page can sleep, so
+// fork() calls this before it holds the child's lock.
+// Returns 0, or -1 if a page could not be read in.
+int
+mmapshare(struct proc *p)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint64 a;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 || (v->flags & MAP_SHARED) == 0 || v->prot == PROT_NONE)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if((pte == 0 || (*pte & PTE_V) == 0) && mmapfault(p, v, a, 0) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// Give child np copies of p's regions.  Pages of MAP_SHARED
+// regions, which mmapshare() has faulted in, are shared; those
+// of MAP_PRIVATE regions are shared copy-on-write.
+// Doesn't sleep.
+// Returns 0 on success; on failure, leaves np with no mapped
+// regions and returns -1.
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    if(v->len == 0)
+      continue;
+    if(uvmcopy(p->pagetable, np->pagetable, v->addr, v->len,
+               (v->flags & MAP_SHARED) != 0) < 0)
+      goto bad;
+  }
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    if(np->vma[i].f)
+      filedup(np->vma[i].f);
+  }
+  return 0;
+
+ bad:
+  while(--i >= 0){
+    v = &p->vma[i];
+    if(v->len)
+      uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+  }
+  return -1;
+}
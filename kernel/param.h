@@ -6,10 +6,15 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXSEG        4  // max loadable segments per program
+#define NVMA         16  // mmap()ed regions per process
+#define PIPEORDER     1  // pipe buffers are 2^PIPEORDER pages
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*6)  // size of disk block cache
+#define NBIOSEG       8  // most blocks merged into one disk request
+#define MAXDISKPOLL  2000  // most microseconds a disk waiter polls
+#define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
@@ -7,18 +7,40 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "uio.h"
 
-#define PIPESIZE 512
+// Data moves through a ring of PIPESIZE bytes from the buddy
+// allocator, copied in as many bytes at a time as fit before
+// the end of the ring.  Readers sleep only when the ring is
+// empty, and writers only when it is full, so a writer wakes
+// a reader only when it adds to an empty ring, and a reader
+// wakes a writer only when it takes from a full one.
+//
+// splice() moves file data straight between the buffer cache
+// and the ring, sleeping in readi()/writei() without pi->lock;
+// wbusy (rbusy) keeps other writers (readers) out meanwhile.
+
+#define PIPESIZE (PGSIZE << PIPEORDER)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // ring of PIPESIZE bytes
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int wbusy;      // splice is filling the ring after nwrite
+  int rbusy;      // splice is draining the ring at nread
 };
 
+static struct kcache *pipecache;
+
+void
+pipeinit(void)
+{
+  pipecache = kcachecreate("pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +50,19 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kcachealloc(pipecache)) == 0)
+    goto bad;
+  if((pi->data = buddyalloc(PIPEORDER)) == 0){
+    kcachefree(pipecache, pi);
+    pi = 0;
     goto bad;
+  }
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->wbusy = 0;
+  pi->rbusy = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -46,8 +75,10 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
-    kfree((char*)pi);
+  if(pi){
+    buddyfree(pi->data, PIPEORDER);
+    kcachefree(pipecache, pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,63 +99,217 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    freelock(&pi->lock);
+    buddyfree(pi->data, PIPEORDER);
+    kcachefree(pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Write the n bytes of the iovcnt user segments in iov to pi,
+// all under one acquisition of pi->lock.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewritev(struct pipe *pi, struct iovec *iov, int iovcnt, int n)
 {
-  int i = 0;
+  int i = 0, seg = 0, slept = 0;
+  uint m;
+  uint64 off = 0;  // into iov[seg]
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
   while(i < n){
-    if(pi->readopen == 0 || pr->killed){
+    if(pi->readopen == 0 || pr->killed)
+      break;
+    if(pi->wbusy || pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+      sleep(&pi->nwrite, &pi->lock);
+      slept = 1;
+      continue;
+    }
+    while(off == iov[seg].iov_len){
+      seg++;
+      off = 0;
+    }
+    // as much as fits, up to the end of the ring.
+    m = iov[seg].iov_len - off;
+    if(m > pi->nread + PIPESIZE - pi->nwrite)
+      m = pi->nread + PIPESIZE - pi->nwrite;
+    if(m > PIPESIZE - pi->nwrite % PIPESIZE)
+      m = PIPESIZE - pi->nwrite % PIPESIZE;
+    if(copyin(pr->pagetable, &pi->data[pi->nwrite % PIPESIZE], (uint64)iov[seg].iov_base + off, m) == -1)
+      break;
+    if(pi->nwrite == pi->nread)
+      wakeupone(&pi->nread);  // no longer empty
+    pi->nwrite += m;
+    off += m;
+    i += m;
+  }
+  // pass the wakeup on to the next writer if there is still room.
+  if(slept && pi->nwrite < pi->nread + PIPESIZE)
+    wakeupone(&pi->nwrite);
+  if(i < n && (pi->readopen == 0 || pr->killed)){
+    release(&pi->lock);
+    return -1;
+  }
+  release(&pi->lock);
+
+  return i;
+}
+
+// Read up to n bytes from pi into the iovcnt user segments
+// in iov, which hold n bytes.
+int
+pipereadv(struct pipe *pi, struct iovec *iov, int iovcnt, int n)
+{
+  int i, seg = 0, slept = 0;
+  uint m;
+  uint64 off = 0;  // into iov[seg]
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen)){  //DOC: pipe-empty
+    if(pr->killed){
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+    sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    slept = 1;
+  }
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    while(off == iov[seg].iov_len){
+      seg++;
+      off = 0;
     }
+    // as much as there is, up to the end of the ring.
+    m = iov[seg].iov_len - off;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > PIPESIZE - pi->nread % PIPESIZE)
+      m = PIPESIZE - pi->nread % PIPESIZE;
+    if(copyout(pr->pagetable, (uint64)iov[seg].iov_base + off, &pi->data[pi->nread % PIPESIZE], m) == -1)
+      break;
+    if(pi->nwrite == pi->nread + PIPESIZE)
+      wakeupone(&pi->nwrite);  //DOC: piperead-wakeup
+    pi->nread += m;
+    off += m;
   }
-  wakeup(&pi->nread);
+  // pass the wakeup on to the next reader if data is left.
+  if(slept && pi->nread != pi->nwrite)
+    wakeupone(&pi->nread);
   release(&pi->lock);
+  return i;
+}
+
+// Move up to n bytes from inode file f to pi, reading them from
+// the buffer cache straight into the ring.  Stops early at end
+// of file.  Returns the number of bytes moved, or -1.
+int
+pipesplicein(struct pipe *pi, struct file *f, int n)
+{
+  int i = 0, r = 0, busy = 0;
+  uint m;
+  char *dst;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(i < n){
+    if(pi->readopen == 0 || pr->killed){
+      r = -1;
+      break;
+    }
+    if(pi->wbusy || pi->nwrite == pi->nread + PIPESIZE){
+      sleep(&pi->nwrite, &pi->lock);
+      continue;
+    }
+    m = n - i;
+    if(m > pi->nread + PIPESIZE - pi->nwrite)
+      m = pi->nread + PIPESIZE - pi->nwrite;
+    if(m > PIPESIZE - pi->nwrite % PIPESIZE)
+      m = PIPESIZE - pi->nwrite % PIPESIZE;
+    dst = &pi->data[pi->nwrite % PIPESIZE];
+    pi->wbusy = busy = 1;
+    release(&pi->lock);
+
+    ilock(f->ip);
+    if((r = readi(f->ip, 0, (uint64)dst, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
 
+    acquire(&pi->lock);
+    pi->wbusy = 0;
+    if(r <= 0)
+      break;
+    if(pi->nwrite == pi->nread)
+      wakeupone(&pi->nread);  // no longer empty
+    pi->nwrite += r;
+    i += r;
+    if(r < m)
+      break;  // end of file
+  }
+  // let in a writer that waited for wbusy.
+  if(busy && pi->nwrite < pi->nread + PIPESIZE)
+    wakeupone(&pi->nwrite);
+  release(&pi->lock);
+  if(i == 0 && r < 0)
+    return -1;
   return i;
 }
 
+// Move up to n bytes from pi to inode file f, writing them from
+// the ring straight into the buffer cache.  Like piperead(),
+// waits for data, then moves what there is.
+// Returns the number of bytes moved, 0 at end of file, or -1.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+pipespliceout(struct pipe *pi, struct file *f, int n)
 {
-  int i;
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i = 0, r = 0, busy = 0;
+  uint m;
+  char *src;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen)){
     if(pr->killed){
       release(&pi->lock);
       return -1;
     }
-    sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    sleep(&pi->nread, &pi->lock);
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
+  while(i < n && pi->nread != pi->nwrite){
+    m = n - i;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > PIPESIZE - pi->nread % PIPESIZE)
+      m = PIPESIZE - pi->nread % PIPESIZE;
+    if(m > max)
+      m = max;
+    src = &pi->data[pi->nread % PIPESIZE];
+    pi->rbusy = busy = 1;
+    release(&pi->lock);
+
+    begin_op();
+    ilock(f->ip);
+    if((r = writei(f->ip, 0, (uint64)src, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    end_op();
+
+    acquire(&pi->lock);
+    pi->rbusy = 0;
+    if(r <= 0)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    if(pi->nwrite == pi->nread + PIPESIZE)
+      wakeupone(&pi->nwrite);  // no longer full
+    pi->nread += r;
+    i += r;
+    if(r != m)
       break;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  // let in a reader that waited for rbusy.
+  if(busy && (pi->nread != pi->nwrite || pi->writeopen == 0))
+    wakeupone(&pi->nread);
   release(&pi->lock);
+  if(i == 0 && r < 0)
+    return -1;
   return i;
 }
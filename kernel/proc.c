@@ -27,6 +27,31 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// Per-CPU queues of RUNNABLE processes, so that
+// scheduler() never has to scan proc[].
+// yield(), wakeup(), kill() and fork() append to a queue;
+// an idle CPU steals from the longest queue of another CPU.
+// a run queue's lock must be acquired after any p->lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+  volatile int n;       // queue length; read without the lock as a hint
+} runq[NCPU];
+
+// Sleeping processes, hashed by sleep channel, so that
+// wakeup() only looks at processes that might be waiting
+// on its channel.  Each bucket is a FIFO list.
+// a sleep queue's lock must be acquired before any p->lock.
+#define NSLEEPQ 61
+#define SLEEPQ(chan) (&sleepq[((uint64)(chan) >> 3) % NSLEEPQ])
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+} sleepq[NSLEEPQ];
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -51,6 +76,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->kstack = KSTACK((int) (p - proc));
@@ -98,6 +127,71 @@ allocpid() {
   return pid;
 }
 
+// Mark p RUNNABLE and append it to CPU id's run queue.
+// Caller must hold p->lock.
+static void
+runqput(struct proc *p, int id)
+{
+  struct runq *rq = &runq[id];
+
+  p->state = RUNNABLE;
+  p->lastcpu = id;
+
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  if(rq->tail)
+    rq->tail->rqnext = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  rq->n++;
+  release(&rq->lock);
+}
+
+// Remove and return the process at the head of
+// CPU id's run queue, or 0 if the queue is empty.
+static struct proc*
+runqget(int id)
+{
+  struct runq *rq = &runq[id];
+  struct proc *p;
+
+  if(rq->n == 0)
+    return 0;
+
+  acquire(&rq->lock);
+  p = rq->head;
+  if(p){
+    rq->head = p->rqnext;
+    if(rq->head == 0)
+      rq->tail = 0;
+    p->rqnext = 0;
+    rq->n--;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Called by CPU id when its own run queue is empty:
+// take a process from the busiest other CPU's queue.
+static struct proc*
+runqsteal(int id)
+{
+  int i, busiest, most;
+
+  busiest = -1;
+  most = 0;
+  for(i = 0; i < NCPU; i++){
+    if(i != id && runq[i].n > most){
+      most = runq[i].n;
+      busiest = i;
+    }
+  }
+  if(busiest < 0)
+    return 0;
+  return runqget(busiest);
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
@@ -164,6 +258,8 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->rqnext = 0;
+  p->sqnext = 0;
   p->state = UNUSED;
 }
 
@@ -243,25 +339,29 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  runqput(p, cpuid());
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only reserves the address space; pages are
+// allocated when first touched (see vmfault()).
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if(sz + n > mmapbase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
+    if((uint64)-(long)n > sz)
+      return -1;
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
   p->sz = sz;
@@ -277,18 +377,28 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+  // Read in shared mapped pages now, since that can sleep,
+  // and we can't once we hold np->lock.
+  if(mmapshare(p) < 0)
+    return -1;
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  if(uvmcopy(p->pagetable, np->pagetable, 0, p->sz, 0) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->sz = p->sz;  // so freeproc() frees it if mmapfork() fails
+  if(mmapfork(p, np) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -301,6 +411,10 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->execip)
+    np->execip = idup(p->execip);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -313,7 +427,7 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  runqput(np, cpuid());
   release(&np->lock);
 
   return pid;
@@ -345,6 +459,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Write back and unmap mmap()ed regions.
+  mmapexit(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -356,8 +473,12 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->execip)
+    iput(p->execip);
   end_op();
   p->cwd = 0;
+  p->execip = 0;
+  p->nseg = 0;
 
   acquire(&wait_lock);
 
@@ -388,6 +509,7 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  vmprefault(p, addr, sizeof(int));
   acquire(&wait_lock);
 
   for(;;){
@@ -431,7 +553,8 @@ wait(uint64 addr)
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process from this CPU's run queue,
+//    or steal one from another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -440,28 +563,34 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = runqget(id)) == 0 && (p = runqsteal(id)) == 0)
+      continue;
+
+    // p is now on no run queue, so no other CPU can choose it.
+    // If p just yield()ed on another CPU, acquiring p->lock
+    // waits until that CPU has finished swtch()ing away from it.
+    acquire(&p->lock);
+    if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      p->lastcpu = id;
+      c->proc = p;
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
     }
+    release(&p->lock);
   }
 }
 
@@ -498,7 +627,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runqput(p, cpuid());
   sched();
   release(&p->lock);
 }
@@ -519,6 +648,9 @@ forkret(void)
     // be run from main().
     first = 0;
     fsinit(ROOTDEV);
+#ifdef DISKBENCH
+    diskbench();  // time disk reads at each queue depth
+#endif
   }
 
   usertrapret();
@@ -530,24 +662,34 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq = SLEEPQ(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold chan's sleep queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the sleep queue, and then p->lock,
+  // which stays held until p is off this CPU),
   // so it's okay to release lk.
 
+  acquire(&sq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->sqnext = 0;
+  if(sq->tail)
+    sq->tail->sqnext = p;
+  else
+    sq->head = p;
+  sq->tail = p;
+  release(&sq->lock);
 
   sched();
 
-  // Tidy up.
+  // Tidy up.  Whoever woke us took us off the sleep queue.
   p->chan = 0;
 
   // Reacquire original lock.
@@ -555,22 +697,65 @@ sleep(void *chan, struct spinlock *lk)
   acquire(lk);
 }
 
+// Take p off sleep queue sq and make it RUNNABLE.
+// prev is p's predecessor on sq, or 0 if p is the head.
+// Caller must hold sq->lock and p->lock.
+static void
+unsleep(struct sleepq *sq, struct proc *prev, struct proc *p)
+{
+  if(prev)
+    prev->sqnext = p->sqnext;
+  else
+    sq->head = p->sqnext;
+  if(sq->tail == p)
+    sq->tail = prev;
+  p->sqnext = 0;
+  runqput(p, p->lastcpu);
+}
+
+// Wake up processes sleeping on chan, in the order
+// they went to sleep: all of them, or just the first.
+static void
+wakeupq(void *chan, int all)
+{
+  struct sleepq *sq = SLEEPQ(chan);
+  struct proc *p, *prev, *next;
+
+  acquire(&sq->lock);
+  prev = 0;
+  for(p = sq->head; p; p = next){
+    next = p->sqnext;
+    if(p->chan != chan){
+      prev = p;
+      continue;
+    }
+    acquire(&p->lock);
+    unsleep(sq, prev, p);
+    release(&p->lock);
+    if(!all)
+      break;
+  }
+  release(&sq->lock);
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wakeupq(chan, 1);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-    }
-  }
+// Wake up the process that has slept longest on chan.
+// For resources that only one waiter can use at a time,
+// to avoid waking all of them just to have most go
+// back to sleep.  The woken process must pass the
+// wakeup on if it leaves the resource available.
+// Must be called without any p->lock.
+void
+wakeupone(void *chan)
+{
+  wakeupq(chan, 0);
 }
 
 // Kill the process with the given pid.
@@ -579,17 +764,35 @@ wakeup(void *chan)
 int
 kill(int pid)
 {
-  struct proc *p;
+  struct proc *p, *q, *prev;
+  struct sleepq *sq;
+  void *chan;
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
+      if(p->state != SLEEPING){
+        release(&p->lock);
+        return 0;
       }
+      // Wake process from sleep().  The sleep queue
+      // lock must be taken before p->lock, so look
+      // again once both are held.
+      chan = p->chan;
       release(&p->lock);
+      sq = SLEEPQ(chan);
+      acquire(&sq->lock);
+      prev = 0;
+      for(q = sq->head; q && q != p; q = q->sqnext)
+        prev = q;
+      if(q){
+        acquire(&p->lock);
+        if(p->pid == pid && p->state == SLEEPING && p->chan == chan)
+          unsleep(sq, prev, p);
+        release(&p->lock);
+      }
+      release(&sq->lock);
       return 0;
     }
     release(&p->lock);
@@ -80,6 +80,24 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A loadable segment of a process's program file.
+// Its pages are read in on first touch (see vmfault()).
+struct seg {
+  uint64 va;       // Page-aligned start address
+  uint64 filesz;   // Bytes that come from the file
+  uint64 off;      // File offset of va
+};
+
+// A region of memory mapped by mmap().
+struct vma {
+  uint64 addr;     // Page-aligned start address
+  uint64 len;      // Page-aligned length, 0 if slot is unused
+  int prot;        // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;       // MAP_SHARED or MAP_PRIVATE, maybe MAP_ANONYMOUS
+  struct file *f;  // Mapped file, or 0 if anonymous
+  uint64 off;      // File offset of addr
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -90,10 +108,17 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int lastcpu;                 // CPU whose run queue p was last put on
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
 
+  // the lock of the run queue p is on must be held when using this:
+  struct proc *rqnext;         // Next process on the same run queue
+
+  // the lock of the sleep queue p is on must be held when using this:
+  struct proc *sqnext;         // Next process sleeping in the same bucket
+
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
@@ -102,5 +127,9 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *execip;        // Program file, or 0
+  struct seg seg[MAXSEG];      // Segments of execip
+  int nseg;                    // Number of segments in seg[]
+  struct vma vma[NVMA];        // mmap()ed regions
   char name[16];               // Process name (debugging)
 };
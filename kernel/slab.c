@@ -0,0 +1,270 @@
+// Slab allocator for small kernel objects:
+// pipes, open files and in-memory inodes.
+//
+// Each cache hands out objects of one size, carved out of
+// pages from kalloc() ("slabs").  A slab page starts with a
+// struct slab, followed by as many objects as fit; an object's
+// slab is found by rounding its address down to the page.
+// Slabs with free objects are on their cache's partial list,
+// and a slab whose objects are all free again goes back to
+// kalloc().
+//
+// In front of the slabs, each CPU has a magazine: a small
+// stack of free objects with its own lock, so CPUs allocating
+// and freeing objects of the same cache don't contend.
+// kalloc() empties the magazines (kcacheshrink()) before
+// it gives up.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE  8   // max caches
+#define MAGSIZE 16  // objects per magazine
+#define BATCH   (MAGSIZE/2)
+
+struct slab {
+  struct kcache *c;
+  struct slab *next;  // on c->partial
+  struct slab *prev;
+  void *free;         // free objects, linked through their first word
+  int inuse;          // objects handed out, including to magazines
+};
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7)
+
+struct magazine {
+  struct spinlock lock;
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kcache {
+  char *name;
+  uint size;              // object size
+  int perslab;            // objects per slab
+  struct spinlock lock;   // protects partial, nslab and the slabs
+  struct slab *partial;   // slabs with free objects
+  int nslab;              // slab pages in use
+  struct magazine mag[NCPU];
+};
+
+// caches are only created at boot, before other CPUs start.
+static struct kcache caches[NCACHE];
+static int ncache;
+
+// Create a cache of objects of size bytes.
+struct kcache*
+kcachecreate(char *name, uint size)
+{
+  struct kcache *c;
+
+  size = (size + 7) & ~7;
+  if(ncache == NCACHE || size > PGSIZE - SLABHDR)
+    panic("kcachecreate");
+  c = &caches[ncache++];
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  initlock(&c->lock, "kcache");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&c->mag[i].lock, "kcache");
+  return c;
+}
+
+// Allocate and carve up a new slab for c.
+static struct slab*
+slabnew(struct kcache *c)
+{
+  struct slab *s;
+  char *p;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->c = c;
+  s->inuse = 0;
+  s->free = 0;
+  for(int i = c->perslab - 1; i >= 0; i--){
+    p = (char*)s + SLABHDR + i*c->size;
+    *(void**)p = s->free;
+    s->free = p;
+  }
+  return s;
+}
+
+static void
+partialpush(struct kcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+static void
+partialremove(struct kcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Return the n objects in objs to their slabs, and
+// give slabs that become empty back to kalloc().
+// Returns the number of pages freed.
+static int
+putback(struct kcache *c, void **objs, int n)
+{
+  struct slab *s, *dead;
+  int nfreed;
+
+  dead = 0;
+  acquire(&c->lock);
+  for(int i = 0; i < n; i++){
+    s = (struct slab*)PGROUNDDOWN((uint64)objs[i]);
+    if(s->c != c || s->inuse < 1)
+      panic("kcachefree");
+    if(s->free == 0)
+      partialpush(c, s);
+    *(void**)objs[i] = s->free;
+    s->free = objs[i];
+    if(--s->inuse == 0){
+      partialremove(c, s);
+      c->nslab--;
+      s->next = dead;
+      dead = s;
+    }
+  }
+  release(&c->lock);
+
+  for(nfreed = 0; dead; nfreed++){
+    s = dead;
+    dead = s->next;
+    kfree(s);
+  }
+  return nfreed;
+}
+
+// Allocate an object from c.
+// Returns 0 if there is no memory.
+// The contents are undefined.
+void*
+kcachealloc(struct kcache *c)
+{
+  struct magazine *m;
+  struct slab *s;
+  void *obj, *batch[BATCH];
+  int n;
+
+  obj = 0;
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  release(&m->lock);
+  pop_off();
+  if(obj)
+    return obj;
+
+  // take a batch from the slabs; keep one, load the rest.
+  acquire(&c->lock);
+  while(c->partial == 0){
+    release(&c->lock);
+    if((s = slabnew(c)) == 0)
+      return 0;
+    acquire(&c->lock);
+    partialpush(c, s);
+    c->nslab++;
+  }
+  for(n = 0; n < BATCH && c->partial; n++){
+    s = c->partial;
+    batch[n] = s->free;
+    s->free = *(void**)s->free;
+    s->inuse++;
+    if(s->free == 0)
+      partialremove(c, s);
+  }
+  release(&c->lock);
+
+  obj = batch[--n];
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  while(n > 0 && m->n < MAGSIZE)
+    m->obj[m->n++] = batch[--n];
+  release(&m->lock);
+  pop_off();
+  if(n > 0)
+    putback(c, batch, n);
+  return obj;
+}
+
+// Free object obj, which came from kcachealloc(c).
+void
+kcachefree(struct kcache *c, void *obj)
+{
+  struct magazine *m;
+  void *batch[BATCH];
+  int n;
+
+  n = 0;
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == MAGSIZE){
+    // full: send the older half back to the slabs.
+    for(n = 0; n < BATCH; n++)
+      batch[n] = m->obj[n];
+    memmove(m->obj, m->obj + BATCH, (MAGSIZE - BATCH) * sizeof(void*));
+    m->n -= BATCH;
+  }
+  m->obj[m->n++] = obj;
+  release(&m->lock);
+  pop_off();
+  if(n > 0)
+    putback(c, batch, n);
+}
+
+// Empty every CPU's magazines back into the slabs,
+// freeing slabs that are no longer used.
+// Returns the number of pages freed.
+int
+kcacheshrink(void)
+{
+  struct kcache *c;
+  struct magazine *m;
+  void *objs[MAGSIZE];
+  int n, nfreed;
+
+  nfreed = 0;
+  for(c = caches; c < &caches[ncache]; c++){
+    for(m = c->mag; m < &c->mag[NCPU]; m++){
+      acquire(&m->lock);
+      n = m->n;
+      memmove(objs, m->obj, n * sizeof(void*));
+      m->n = 0;
+      release(&m->lock);
+      nfreed += putback(c, objs, n);
+    }
+  }
+  return nfreed;
+}
+
+// Number of pages used by slabs, as a hint.
+int
+kcachepages(void)
+{
+  int n = 0;
+
+  for(struct kcache *c = caches; c < &caches[ncache]; c++)
+    n += c->nslab;
+  return n;
+}
@@ -6,14 +6,47 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "proc.h"
+#include "lockstat.h"
 #include "defs.h"
 
+// Every initialized lock, for lockstat().
+// lockslock is zero-initialized, so it can be
+// acquired before it is registered itself.
+#define NLOCK 500
+static struct spinlock *locks[NLOCK];
+static struct spinlock lockslock;
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->nacquire = 0;
+  lk->nspin = 0;
+
+  acquire(&lockslock);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == 0){
+      locks[i] = lk;
+      break;
+    }
+  }
+  release(&lockslock);
+}
+
+// Forget a lock that lives in memory about to be freed.
+void
+freelock(struct spinlock *lk)
+{
+  acquire(&lockslock);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == lk){
+      locks[i] = 0;
+      break;
+    }
+  }
+  release(&lockslock);
 }
 
 // Acquire the lock.
@@ -21,6 +54,8 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint64 spins = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
@@ -30,7 +65,7 @@ acquire(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    spins++;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +75,8 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->nacquire++;
+  lk->nspin += spins;
 }
 
 // Release the lock.
@@ -81,6 +118,27 @@ holding(struct spinlock *lk)
   return r;
 }
 
+// Sum the contention statistics of all locks named name.
+void
+lockstat(char *name, struct lockstat *st)
+{
+  struct spinlock *lk;
+
+  st->nlock = 0;
+  st->nacquire = 0;
+  st->nspin = 0;
+  acquire(&lockslock);
+  for(int i = 0; i < NLOCK; i++){
+    lk = locks[i];
+    if(lk == 0 || strncmp(lk->name, name, MAXPATH) != 0)
+      continue;
+    st->nlock++;
+    st->nacquire += lk->nacquire;
+    st->nspin += lk->nspin;
+  }
+  release(&lockslock);
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -5,5 +5,9 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For contention statistics (see lockstat()):
+  uint64 nacquire;   // Number of times acquired.
+  uint64 nspin;      // Failed test-and-sets while acquiring.
 };
 
@@ -0,0 +1,70 @@
+//
+// Boot-time microbenchmark of memset(), memmove() and memcmp(),
+// run when the kernel is built with make STRBENCH=1.
+// For each size, moves about a megabyte in calls of that size,
+// with the destination aligned and then misaligned by one byte,
+// and prints bytes per cycle.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define TOTAL (1 << 20)
+
+static int sizes[] = { 8, 64, 512, 4096 };
+
+static void
+report(char *what, int n, int mis, uint64 cycles)
+{
+  uint64 r;
+
+  if(cycles == 0)
+    cycles = 1;
+  r = (uint64)TOTAL * 100 / cycles;  // hundredths of bytes/cycle
+  printf("  %s %d%s: %d.%d%d\n", what, n, mis ? " misaligned" : "",
+         (int)(r / 100), (int)(r / 10 % 10), (int)(r % 10));
+}
+
+void
+strbench(void)
+{
+  char *a, *b;
+  uint64 t;
+  int i, j, n, mis, iters, diff;
+
+  // two pages each, so that size+1 fits.
+  if((a = buddyalloc(1)) == 0 || (b = buddyalloc(1)) == 0)
+    panic("strbench");
+  memset(b, 'x', 2*PGSIZE);
+
+  printf("strbench: bytes per cycle\n");
+  diff = 0;
+  for(i = 0; i < NELEM(sizes); i++){
+    n = sizes[i];
+    iters = TOTAL / n;
+    for(mis = 0; mis < 2; mis++){
+      t = r_cycle();
+      for(j = 0; j < iters; j++)
+        memset(a + mis, j, n);
+      report("memset ", n, mis, r_cycle() - t);
+
+      t = r_cycle();
+      for(j = 0; j < iters; j++)
+        memmove(a + mis, b, n);
+      report("memmove", n, mis, r_cycle() - t);
+
+      // equal, so every byte is compared.
+      t = r_cycle();
+      for(j = 0; j < iters; j++)
+        diff |= memcmp(a + mis, b, n);
+      report("memcmp ", n, mis, r_cycle() - t);
+    }
+  }
+  if(diff)
+    panic("strbench: memcmp");
+
+  buddyfree(a, 1);
+  buddyfree(b, 1);
+}
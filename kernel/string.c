@@ -1,13 +1,38 @@
 #include "types.h"
 
+// memset(), memmove() and memcmp() work a 64-bit word at a time
+// once the destination is aligned, four words per loop
+// iteration, with byte loops for the unaligned head and tail.
+
+#define WSIZE 8
+#define WMASK (WSIZE - 1)
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uchar *d = dst;
+  uint64 w, *wd;
+
+  for(; n > 0 && ((uint64)d & WMASK) != 0; n--)
+    *d++ = c;
+  if(n >= WSIZE){
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wd = (uint64*)d;
+    for(; n >= 4*WSIZE; n -= 4*WSIZE, wd += 4){
+      wd[0] = w;
+      wd[1] = w;
+      wd[2] = w;
+      wd[3] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = w;
+    d = (uchar*)wd;
   }
+  while(n-- > 0)
+    *d++ = c;
   return dst;
 }
 
@@ -18,6 +43,15 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & WMASK) == 0){
+    for(; n > 0 && ((uint64)s1 & WMASK) != 0; n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    // skip equal words; the bytes below find the difference.
+    for(; n >= WSIZE; n -= WSIZE, s1 += WSIZE, s2 += WSIZE)
+      if(*(uint64*)s1 != *(uint64*)s2)
+        break;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -27,11 +61,49 @@ memcmp(const void *v1, const void *v2, uint n)
   return 0;
 }
 
+// Copy n bytes forward from s to word-aligned d, n >= WSIZE.
+// Returns the number of bytes left over.
+static uint
+wcopy(uint64 *d, const uchar *s, uint n)
+{
+  const uint64 *ws;
+  uint64 prev, next;
+  int lo, hi;
+
+  if(((uint64)s & WMASK) == 0){
+    ws = (const uint64*)s;
+    for(; n >= 4*WSIZE; n -= 4*WSIZE, d += 4, ws += 4){
+      d[0] = ws[0];
+      d[1] = ws[1];
+      d[2] = ws[2];
+      d[3] = ws[3];
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *d++ = *ws++;
+    return n;
+  }
+
+  // s is misaligned: load aligned words and shift them together.
+  // The last load may go up to 7 bytes past the end of s, but
+  // not past the aligned word holding its last byte.
+  lo = ((uint64)s & WMASK) * 8;
+  hi = 64 - lo;
+  ws = (const uint64*)((uint64)s & ~WMASK);
+  prev = *ws++;
+  for(; n >= WSIZE; n -= WSIZE){
+    next = *ws++;
+    *d++ = (prev >> lo) | (next << hi);
+    prev = next;
+  }
+  return n;
+}
+
 void*
 memmove(void *dst, const void *src, uint n)
 {
-  const char *s;
-  char *d;
+  const uchar *s;
+  uchar *d;
+  uint m;
 
   if(n == 0)
     return dst;
@@ -39,13 +111,33 @@ memmove(void *dst, const void *src, uint n)
   s = src;
   d = dst;
   if(s < d && s + n > d){
+    // overlapping, so copy backward; by words only if
+    // s and d can both be aligned.
     s += n;
     d += n;
+    if((((uint64)s ^ (uint64)d) & WMASK) == 0){
+      for(; n > 0 && ((uint64)d & WMASK) != 0; n--)
+        *--d = *--s;
+      for(; n >= WSIZE; n -= WSIZE){
+        d -= WSIZE;
+        s -= WSIZE;
+        *(uint64*)d = *(const uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    for(; n > 0 && ((uint64)d & WMASK) != 0; n--)
+      *d++ = *s++;
+    if(n >= WSIZE){
+      m = n - wcopy((uint64*)d, s, n);
+      d += m;
+      s += m;
+      n -= m;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -105,6 +105,20 @@ extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_getprocs(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_fstatat(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_blkstat(void);
+extern uint64 sys_diskpoll(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -129,6 +143,20 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_getprocs]   sys_getprocs,
+[SYS_lockstat]   sys_lockstat,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_memstat]   sys_memstat,
+[SYS_splice]  sys_splice,
+[SYS_getdents] sys_getdents,
+[SYS_fstatat] sys_fstatat,
+[SYS_lseek]   sys_lseek,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_blkstat] sys_blkstat,
+[SYS_diskpoll] sys_diskpoll,
 };
 
 void
@@ -21,3 +21,17 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_getprocs  22
+#define SYS_lockstat  23
+#define SYS_mmap   24
+#define SYS_munmap 25
+#define SYS_memstat 26
+#define SYS_splice 27
+#define SYS_getdents 28
+#define SYS_fstatat 29
+#define SYS_lseek  30
+#define SYS_pread  31
+#define SYS_pwrite 32
+#define SYS_readv  33
+#define SYS_writev 34
+#define SYS_blkstat 35
+#define SYS_diskpoll 36
@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -91,6 +93,99 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// int splice(int fd_in, int fd_out, int n)
+uint64
+sys_splice(void)
+{
+  struct file *fin, *fout;
+  int n;
+
+  if(argfd(0, 0, &fin) < 0 || argfd(1, 0, &fout) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(fin, fout, n);
+}
+
+// Fetch the iovec array of a readv() or writev() into iov,
+// which has room for IOV_MAX entries.
+static int
+argiov(struct iovec *iov, int *iovcnt)
+{
+  uint64 addr;
+
+  if(argaddr(1, &addr) < 0 || argint(2, iovcnt) < 0)
+    return -1;
+  if(*iovcnt < 0 || *iovcnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, *iovcnt * sizeof(*iov)) < 0)
+    return -1;
+  return 0;
+}
+
+// int readv(int fd, struct iovec *iov, int iovcnt)
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int iovcnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &iovcnt) < 0)
+    return -1;
+  return filereadv(f, iov, iovcnt);
+}
+
+// int writev(int fd, struct iovec *iov, int iovcnt)
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int iovcnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &iovcnt) < 0)
+    return -1;
+  return filewritev(f, iov, iovcnt);
+}
+
+// long lseek(int fd, long off, int whence)
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  uint64 off;
+  int whence;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+// int pread(int fd, void *buf, int n, long off)
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  uint64 p, off;
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 || argaddr(3, &off) < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+// int pwrite(int fd, void *buf, int n, long off)
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  uint64 p, off;
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 || argaddr(3, &off) < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
 uint64
 sys_close(void)
 {
@@ -115,6 +210,57 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// int getdents(int fd, struct direntplus *ents, int n, int plus)
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  uint64 ents;
+  int n, plus;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &ents) < 0 || argint(2, &n) < 0 || argint(3, &plus) < 0)
+    return -1;
+  return filegetdents(f, ents, n, plus);
+}
+
+// int fstatat(int dirfd, char *path, struct stat *st)
+// Like stat(), without opening the file.  A relative path
+// starts at directory dirfd, or at the current directory
+// if dirfd is AT_FDCWD.
+uint64
+sys_fstatat(void)
+{
+  char path[MAXPATH];
+  struct file *f;
+  struct inode *dp, *ip;
+  struct stat st;
+  uint64 addr;
+  int dirfd;
+
+  if(argint(0, &dirfd) < 0 || argstr(1, path, MAXPATH) < 0 || argaddr(2, &addr) < 0)
+    return -1;
+  dp = 0;
+  if(dirfd != AT_FDCWD){
+    if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+      return -1;
+    dp = f->ip;
+  }
+
+  begin_op();
+  if((ip = nameiat(dp, path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+  stati(ip, &st);
+  iunlockput(ip);
+  end_op();
+
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -243,13 +389,15 @@ create(char *path, short type, short major, short minor)
 {
   struct inode *ip, *dp;
   char name[DIRSIZ];
+  uint off;
 
   if((dp = nameiparent(path, name)) == 0)
     return 0;
 
   ilock(dp);
 
-  if((ip = dirlookup(dp, name, 0)) != 0){
+  off = -1;
+  if((ip = dirlookup(dp, name, &off)) != 0){
     iunlockput(dp);
     ilock(ip);
     if(type == T_FILE && (ip->type == T_FILE || ip->type == T_DEVICE))
@@ -258,8 +406,11 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  // no memory for an existing name's inode, or for the new one.
+  if(off != -1 || (ip = ialloc(dp->dev, type)) == 0){
+    iunlockput(dp);
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
@@ -484,3 +635,31 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// void *mmap(void *addr, uint len, int prot, int flags, int fd, uint off)
+// addr is only a hint, and is ignored.
+uint64
+sys_mmap(void)
+{
+  uint64 len, off;
+  int prot, flags, fd;
+  struct file *f;
+
+  if(argaddr(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(4, &fd) < 0 || argaddr(5, &off) < 0)
+    return -1;
+  f = 0;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
@@ -6,6 +6,9 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "lockstat.h"
+#include "memstat.h"
+#include "blkstat.h"
 
 uint64
 sys_exit(void)
@@ -41,7 +44,7 @@ sys_wait(void)
 uint64
 sys_sbrk(void)
 {
-  int addr;
+  uint64 addr;
   int n;
 
   if(argint(0, &n) < 0)
@@ -107,3 +110,62 @@ sys_getprocs(void)
     return -1;
   return(procinfo(addr));
 }
+
+// sum up contention statistics of all spinlocks with a given name
+// and copy them into a user-provided struct lockstat
+uint64
+sys_lockstat(void)
+{
+  char name[MAXPATH];
+  uint64 addr;  // user pointer to struct lockstat
+  struct lockstat st;
+
+  if(argstr(0, name, MAXPATH) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  lockstat(name, &st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_memstat(void)
+{
+  uint64 addr;  // user pointer to struct memstat
+  struct memstat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  kstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_blkstat(void)
+{
+  uint64 addr;  // user pointer to struct blkstat
+  struct blkstat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  blkstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Set how many microseconds a process waiting for the disk
+// polls before sleeping, 0 for none, up to MAXDISKPOLL,
+// since interrupts are off meanwhile.
+// Returns the previous setting.
+uint64
+sys_diskpoll(void)
+{
+  int us;
+
+  if(argint(0, &us) < 0 || us < 0 || us > MAXDISKPOLL)
+    return -1;
+  return virtio_disk_setpoll(us);
+}
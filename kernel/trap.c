@@ -65,6 +65,20 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault: a page that hasn't been read from the
+    // program file or allocated yet, or a copy-on-write page.
+    uint64 scause = r_scause();
+    uint64 va = r_stval();
+
+    // reading the page from disk sleeps.
+    intr_on();
+
+    if(vmfault(p, va, scause == 15) < 0){
+      printf("usertrap(): page fault scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, va);
+      p->killed = 1;
+    }
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -0,0 +1,7 @@
+// readv() and writev() buffer segment
+struct iovec {
+  void *iov_base;   // start of segment
+  uint64 iov_len;   // length in bytes
+};
+
+#define IOV_MAX 16  // most segments in one call
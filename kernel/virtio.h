@@ -2,7 +2,8 @@
 // virtio device definitions.
 // for both the mmio interface, and virtio descriptors.
 // only tested with qemu.
-// this is the "legacy" virtio interface.
+// covers both the "legacy" (version 1) and the virtio 1.x
+// (version 2) mmio interfaces.
 //
 // the virtio spec:
 // https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.pdf
@@ -15,18 +16,26 @@
 #define VIRTIO_MMIO_DEVICE_ID		0x008 // device type; 1 is net, 2 is disk
 #define VIRTIO_MMIO_VENDOR_ID		0x00c // 0x554d4551
 #define VIRTIO_MMIO_DEVICE_FEATURES	0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL	0x014 // which 32 feature bits, write-only
 #define VIRTIO_MMIO_DRIVER_FEATURES	0x020
-#define VIRTIO_MMIO_GUEST_PAGE_SIZE	0x028 // page size for PFN, write-only
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL	0x024 // which 32 feature bits, write-only
+#define VIRTIO_MMIO_GUEST_PAGE_SIZE	0x028 // page size for PFN, write-only, legacy
 #define VIRTIO_MMIO_QUEUE_SEL		0x030 // select queue, write-only
 #define VIRTIO_MMIO_QUEUE_NUM_MAX	0x034 // max size of current queue, read-only
 #define VIRTIO_MMIO_QUEUE_NUM		0x038 // size of current queue, write-only
-#define VIRTIO_MMIO_QUEUE_ALIGN		0x03c // used ring alignment, write-only
-#define VIRTIO_MMIO_QUEUE_PFN		0x040 // physical page number for queue, read/write
+#define VIRTIO_MMIO_QUEUE_ALIGN		0x03c // used ring alignment, write-only, legacy
+#define VIRTIO_MMIO_QUEUE_PFN		0x040 // physical page number for queue, read/write, legacy
 #define VIRTIO_MMIO_QUEUE_READY		0x044 // ready bit
 #define VIRTIO_MMIO_QUEUE_NOTIFY	0x050 // write-only
 #define VIRTIO_MMIO_INTERRUPT_STATUS	0x060 // read-only
 #define VIRTIO_MMIO_INTERRUPT_ACK	0x064 // write-only
 #define VIRTIO_MMIO_STATUS		0x070 // read/write
+#define VIRTIO_MMIO_QUEUE_DESC_LOW	0x080 // physical address for descriptor table, write-only
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH	0x084
+#define VIRTIO_MMIO_DRIVER_DESC_LOW	0x090 // physical address for available ring, write-only
+#define VIRTIO_MMIO_DRIVER_DESC_HIGH	0x094
+#define VIRTIO_MMIO_DEVICE_DESC_LOW	0x0a0 // physical address for used ring, write-only
+#define VIRTIO_MMIO_DEVICE_DESC_HIGH	0x0a4
 
 // status register bits, from qemu virtio_config.h
 #define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
@@ -42,10 +51,20 @@
 #define VIRTIO_F_ANY_LAYOUT         27
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
+#define VIRTIO_F_VERSION_1          32 /* the first bit of the second word */
 
-// this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// this many virtio descriptors, so NUM requests in flight
+// with indirect descriptors, NUM/3 without.
+// must be a power of two, no bigger than the device allows
+// (qemu allows 256 by default).  make DISKQ=n changes it.
+#ifdef DISKQ
+#define NUM DISKQ
+#else
+#define NUM 64
+#endif
+#if NUM < 1 || (NUM & (NUM-1)) != 0
+#error "virtio ring size (DISKQ) must be a power of two"
+#endif
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -56,14 +75,16 @@ struct virtq_desc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr is a table of descriptors
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
-  uint16 flags; // always zero
+  uint16 flags; // VRING_AVAIL_F_NO_INTERRUPT, or zero
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 used_event; // with EVENT_IDX: interrupt once used idx passes this
 };
+#define VRING_AVAIL_F_NO_INTERRUPT 1 // without EVENT_IDX: don't interrupt
 
 // one entry in the "used" ring, with which the
 // device tells the driver about completed requests.
@@ -73,10 +94,24 @@ struct virtq_used_elem {
 };
 
 struct virtq_used {
-  uint16 flags; // always zero
+  uint16 flags; // VRING_USED_F_NO_NOTIFY, or zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
+  uint16 avail_event; // with EVENT_IDX: notify once avail idx passes this
 };
+#define VRING_USED_F_NO_NOTIFY 1 // device is busy, no need to notify
+
+// with EVENT_IDX, should the other side be told, now that its
+// index has gone from old to new, when it asked to be told on
+// passing event?  from the spec.
+#define VRING_NEED_EVENT(event, new, old) \
+  ((uint16)((new) - (event) - 1) < (uint16)((new) - (old)))
+
+// queue layout: the descriptors, then the avail ring, then the
+// used ring starting on the next page boundary.  legacy devices
+// require this; version 2 devices take the three addresses.
+#define VQ_USED  PGROUNDUP(NUM*sizeof(struct virtq_desc) + sizeof(struct virtq_avail))
+#define VQ_SIZE  (VQ_USED + PGROUNDUP(sizeof(struct virtq_used)))
 
 // these are specific to virtio block devices, e.g. disks,
 // described in Section 5.2 of the spec.
@@ -85,8 +120,8 @@ struct virtq_used {
 #define VIRTIO_BLK_T_OUT 1 // write the disk
 
 // the format of the first descriptor in a disk request.
-// to be followed by two more descriptors containing
-// the block, and a one-byte status.
+// to be followed by descriptors containing the blocks,
+// and one for a one-byte status.
 struct virtio_blk_req {
   uint32 type; // VIRTIO_BLK_T_IN or ..._OUT
   uint32 reserved;
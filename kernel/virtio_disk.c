@@ -1,7 +1,18 @@
 //
 // driver for qemu's virtio disk device.
-// uses qemu's mmio interface to virtio.
-// qemu presents a "legacy" virtio interface.
+// uses qemu's mmio interface to virtio, either the "legacy"
+// one qemu presents by default or the virtio 1.x one it presents
+// with -global virtio-mmio.force-legacy=false.
+//
+// if the device offers them, requests use indirect descriptors,
+// so each takes one ring slot whatever its number of blocks,
+// and event indexes, so the device only interrupts or is
+// notified when the other side is not already busy looking.
+//
+// in polled mode, a process waiting for the disk spins for up
+// to n microseconds, with interrupts off, before sleeping.
+// make DISKPOLL=n boots in that mode, and the diskpoll()
+// system call switches modes at run time.
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
@@ -16,6 +27,17 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "blkstat.h"
+
+// a request of NBIOSEG blocks must fit in the ring, even
+// without indirect descriptors.
+#if NUM < NBIOSEG+2
+#error "virtio ring size (DISKQ) must be at least NBIOSEG+2"
+#endif
+
+#if defined(DISKPOLL) && DISKPOLL > MAXDISKPOLL
+#error "DISKPOLL must be at most MAXDISKPOLL microseconds"
+#endif
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
@@ -24,8 +46,8 @@ static struct disk {
   // the virtio driver and device mostly communicate through a set of
   // structures in RAM. pages[] allocates that memory. pages[] is a
   // global (instead of calls to kalloc()) because it must consist of
-  // two contiguous pages of page-aligned physical memory.
-  char pages[2*PGSIZE];
+  // contiguous pages of page-aligned physical memory.
+  char pages[VQ_SIZE];
 
   // pages[] is divided into three regions (descriptors, avail, and
   // used), as explained in Section 2.6 of the virtio specification
@@ -61,14 +83,32 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b[NBIOSEG];  // one per data descriptor
+    int n;
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
-  
+
+  // with indirect descriptors, a request's chain is in a table
+  // of its own, pointed to by its one ring descriptor.
+  // also indexed by that descriptor.
+  struct virtq_desc indirect[NUM][NBIOSEG+2];
+
+  int indirect_desc;    // negotiated VIRTIO_RING_F_INDIRECT_DESC?
+  int event_idx;        // negotiated VIRTIO_RING_F_EVENT_IDX?
+  uint16 notified_idx;  // avail->idx when we last notified the device
+
+  uint64 poll;          // polled mode: spin this many r_time() ticks
+  int npolling;         // processes polling; interrupts are off if > 0
+
+  uint64 nintr;         // interrupts
+  uint64 nnotify;       // notifications written to the device
+  uint64 npolled;       // requests reaped by polling
+  uint64 lat[NLAT];     // latency histogram; see struct blkstat
+
   struct spinlock vdisk_lock;
   
 } __attribute__ ((aligned (PGSIZE))) disk;
@@ -77,16 +117,21 @@ void
 virtio_disk_init(void)
 {
   uint32 status = 0;
+  uint32 version;
 
   initlock(&disk.vdisk_lock, "virtio_disk");
 
+  version = *R(VIRTIO_MMIO_VERSION);
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-     *R(VIRTIO_MMIO_VERSION) != 1 ||
+     (version != 1 && version != 2) ||
      *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
      *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
     panic("could not find virtio disk");
   }
-  
+
+  // reset device
+  *R(VIRTIO_MMIO_STATUS) = status;
+
   status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
   *R(VIRTIO_MMIO_STATUS) = status;
 
@@ -94,28 +139,44 @@ virtio_disk_init(void)
   *R(VIRTIO_MMIO_STATUS) = status;
 
   // negotiate features
-  uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  *R(VIRTIO_MMIO_DEVICE_FEATURES_SEL) = 0;
+  uint32 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
+  *R(VIRTIO_MMIO_DRIVER_FEATURES_SEL) = 0;
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.indirect_desc = (features >> VIRTIO_RING_F_INDIRECT_DESC) & 1;
+  disk.event_idx = (features >> VIRTIO_RING_F_EVENT_IDX) & 1;
+#ifdef DISKPOLL
+  disk.poll = (uint64)DISKPOLL * (TIMEBASE / 1000000);
+#endif
+
+  if(version == 2){
+    // of the second word, only VERSION_1; not, e.g., packed rings.
+    *R(VIRTIO_MMIO_DEVICE_FEATURES_SEL) = 1;
+    features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+    if((features & (1 << (VIRTIO_F_VERSION_1 - 32))) == 0)
+      panic("virtio disk has no VERSION_1");
+    *R(VIRTIO_MMIO_DRIVER_FEATURES_SEL) = 1;
+    *R(VIRTIO_MMIO_DRIVER_FEATURES) = 1 << (VIRTIO_F_VERSION_1 - 32);
+  }
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
   *R(VIRTIO_MMIO_STATUS) = status;
 
-  // tell device we're completely ready.
-  status |= VIRTIO_CONFIG_S_DRIVER_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
-
-  *R(VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
+  // a version 2 device clears FEATURES_OK if it won't do without
+  // a feature we declined.
+  if(version == 2 && (*R(VIRTIO_MMIO_STATUS) & VIRTIO_CONFIG_S_FEATURES_OK) == 0)
+    panic("virtio disk FEATURES_OK unset");
 
   // initialize queue 0.
   *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
+  if(version == 2 && *R(VIRTIO_MMIO_QUEUE_READY))
+    panic("virtio disk should not be ready");
   uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
@@ -123,20 +184,37 @@ virtio_disk_init(void)
     panic("virtio disk max queue too short");
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
   memset(disk.pages, 0, sizeof(disk.pages));
-  *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
   // desc = pages -- num * virtq_desc
-  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
-  // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
+  // avail = pages + num * virtq_desc -- 2 * uint16, then num * uint16
+  // used = pages + VQ_USED -- 2 * uint16, then num * vRingUsedElem
 
   disk.desc = (struct virtq_desc *) disk.pages;
   disk.avail = (struct virtq_avail *)(disk.pages + NUM*sizeof(struct virtq_desc));
-  disk.used = (struct virtq_used *) (disk.pages + PGSIZE);
+  disk.used = (struct virtq_used *) (disk.pages + VQ_USED);
+
+  if(version == 1){
+    *R(VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
+    *R(VIRTIO_MMIO_QUEUE_ALIGN) = PGSIZE;
+    *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
+  } else {
+    *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
+    *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk.desc >> 32;
+    *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk.avail;
+    *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk.avail >> 32;
+    *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk.used;
+    *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk.used >> 32;
+    *R(VIRTIO_MMIO_QUEUE_READY) = 1;
+  }
 
   // all NUM descriptors start out unused.
   for(int i = 0; i < NUM; i++)
     disk.free[i] = 1;
 
+  // tell device we're completely ready.
+  status |= VIRTIO_CONFIG_S_DRIVER_OK;
+  *R(VIRTIO_MMIO_STATUS) = status;
+
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
 }
 
@@ -166,7 +244,6 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
-  wakeup(&disk.free[0]);
 }
 
 // free a chain of descriptors.
@@ -184,12 +261,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -200,30 +276,56 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Start a disk request for the n bufs in bs, which hold
+// consecutive blocks, and return without waiting for it;
+// virtio_disk_intr() marks each buf done and wakes it up.
+// The device may not look at it until virtio_disk_notify().
+// Returns -1 if there aren't enough free descriptors, in
+// which case virtio_disk_intr() calls blkkick() when some
+// are freed.  Called by the block queue, in blkq.c.
+int
+virtio_disk_start(struct buf **bs, int n, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = bs[0]->blockno * (BSIZE / 512);
+  int idx[NBIOSEG+2];
+  int head;
+  struct virtq_desc *d;
+
+  if(n < 1 || n > NBIOSEG)
+    panic("virtio_disk_start");
 
   acquire(&disk.vdisk_lock);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
+  // a descriptor for type/reserved/sector, then the data, here one
+  // descriptor per buf, then one for a 1-byte status result.
+  // d[idx[0]], d[idx[1]], ... is that chain: in the ring, or in
+  // the indirect table of the request's one ring descriptor.
+  if(disk.indirect_desc){
+    if(alloc_descs(&head, 1) < 0){
+      release(&disk.vdisk_lock);
+      return -1;
+    }
+    d = disk.indirect[head];
+    for(int i = 0; i < n+2; i++)
+      idx[i] = i;
+    disk.desc[head].addr = (uint64) d;
+    disk.desc[head].len = (n+2) * sizeof(struct virtq_desc);
+    disk.desc[head].flags = VRING_DESC_F_INDIRECT;
+    disk.desc[head].next = 0;
+  } else {
+    if(alloc_descs(idx, n+2) < 0){
+      release(&disk.vdisk_lock);
+      return -1;
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    d = disk.desc;
+    head = idx[0];
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &disk.ops[head];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -232,50 +334,188 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
+  d[idx[0]].addr = (uint64) buf0;
+  d[idx[0]].len = sizeof(struct virtio_blk_req);
+  d[idx[0]].flags = VRING_DESC_F_NEXT;
+  d[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 1; i <= n; i++){
+    d[idx[i]].addr = (uint64) bs[i-1]->data;
+    d[idx[i]].len = BSIZE;
+    if(write)
+      d[idx[i]].flags = 0; // device reads b->data
+    else
+      d[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    d[idx[i]].flags |= VRING_DESC_F_NEXT;
+    d[idx[i]].next = idx[i+1];
+  }
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.info[head].status = 0xff; // device writes 0 on success
+  d[idx[n+1]].addr = (uint64) &disk.info[head].status;
+  d[idx[n+1]].len = 1;
+  d[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  d[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the bufs for virtio_disk_intr().
+  for(int i = 0; i < n; i++){
+    disk.info[head].b[i] = bs[i];
+    bs[i]->dtime = r_time();
+  }
+  disk.info[head].n = n;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % NUM] = head;
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
 
+  release(&disk.vdisk_lock);
+  return 0;
+}
+
+// Tell the device about the requests virtio_disk_start() has
+// added since last time, unless it has said it will find them
+// anyway because it is still working through the ring.
+void
+virtio_disk_notify(void)
+{
+  int notify;
+
+  acquire(&disk.vdisk_lock);
+
+  // make the avail ring entries visible before reading the
+  // device's flags or event index.
   __sync_synchronize();
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  if(disk.event_idx)
+    notify = VRING_NEED_EVENT(disk.used->avail_event, disk.avail->idx, disk.notified_idx);
+  else
+    notify = disk.avail->idx != disk.notified_idx &&
+             (disk.used->flags & VRING_USED_F_NO_NOTIFY) == 0;
+  disk.notified_idx = disk.avail->idx;
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  if(notify){
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+    disk.nnotify++;
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  release(&disk.vdisk_lock);
+}
+
+// Mark the bufs of the requests the device has finished as
+// done, wake up their waiters, and free their descriptors.
+// Returns how many requests finished.
+// Caller must hold vdisk_lock.
+static int
+reap(void)
+{
+  int n = 0;
 
+  // the device increments disk.used->idx when it
+  // adds an entry to the used ring.
+
+  while(disk.used_idx != disk.used->idx){
+    __sync_synchronize();
+    int id = disk.used->ring[disk.used_idx % NUM].id;
+
+    if(disk.info[id].status != 0)
+      panic("virtio_disk_intr status");
+
+    for(int i = 0; i < disk.info[id].n; i++){
+      struct buf *b = disk.info[id].b[i];
+      b->disk = 0;   // disk is done with buf
+      wakeup(b);
+    }
+    disk.info[id].n = 0;
+    free_chain(id);
+
+    disk.used_idx += 1;
+    n++;
+  }
+  return n;
+}
+
+// Ask the device to interrupt at its next completion, and reap
+// any that came before it saw that.  Returns how many.
+// Caller must hold vdisk_lock.
+static int
+disk_intr_on(void)
+{
+  int n = 0;
+
+  while(1){
+    if(disk.event_idx)
+      disk.avail->used_event = disk.used_idx;
+    else
+      disk.avail->flags = 0;
+    __sync_synchronize();
+    if(disk.used_idx == disk.used->idx)
+      return n;
+    n += reap();
+  }
+}
+
+// Ask the device not to interrupt, while someone is polling.
+// With event indexes, an index it has just passed does that.
+// Caller must hold vdisk_lock.
+static void
+disk_intr_off(void)
+{
+  if(disk.event_idx)
+    disk.avail->used_event = disk.used_idx - 1;
+  else
+    disk.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+}
+
+// Wait for the disk to finish with b.
+// In polled mode, first spin for up to disk.poll ticks reaping
+// completions ourselves, with the device's interrupts off,
+// since that is quicker than sleeping until virtio_disk_intr()
+// says it has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  uint64 t0, t;
+  int waited, n;
+
+  acquire(&disk.vdisk_lock);
+  waited = b->disk;
+  if(b->disk && disk.poll){
+    if(disk.npolling++ == 0)
+      disk_intr_off();
+    t0 = r_time();
+    while(b->disk && r_time() - t0 < disk.poll){
+      n = reap();
+      disk.npolled += n;
+      if(n > 0){
+        // start queued requests in the freed descriptors.
+        release(&disk.vdisk_lock);
+        blkkick();
+        acquire(&disk.vdisk_lock);
+      } else {
+        // let this hart take interrupts.
+        release(&disk.vdisk_lock);
+        acquire(&disk.vdisk_lock);
+      }
+    }
+    if(--disk.npolling == 0 && disk_intr_on() > 0){
+      release(&disk.vdisk_lock);
+      blkkick();
+      acquire(&disk.vdisk_lock);
+    }
+  }
+  while(b->disk == 1) {
+    sleep(b, &disk.vdisk_lock);
+  }
+  if(waited){
+    // latency from being sent to the disk, in microseconds.
+    t = (r_time() - b->dtime) / (TIMEBASE / 1000000);
+    for(n = 0; n < NLAT-1 && t >= 2; n++)
+      t /= 2;
+    disk.lat[n]++;
+  }
   release(&disk.vdisk_lock);
 }
 
@@ -294,22 +534,44 @@ virtio_disk_intr()
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
+  disk.nintr++;
 
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+  reap();
 
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
+  // completions that came while we were here need no interrupt.
+  // but leave interrupts off while someone is polling.
+  if(disk.npolling == 0)
+    disk_intr_on();
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+  release(&disk.vdisk_lock);
 
-    disk.used_idx += 1;
-  }
+  // start queued requests in the freed descriptors.
+  blkkick();
+}
+
+// Poll for up to us microseconds from now on, or, if us is 0,
+// only sleep until interrupts.  Returns the previous setting.
+uint64
+virtio_disk_setpoll(uint64 us)
+{
+  uint64 old;
 
+  acquire(&disk.vdisk_lock);
+  old = disk.poll / (TIMEBASE / 1000000);
+  disk.poll = us * (TIMEBASE / 1000000);
+  release(&disk.vdisk_lock);
+  return old;
+}
+
+// Add the driver's counts to st.
+void
+virtio_disk_stat(struct blkstat *st)
+{
+  acquire(&disk.vdisk_lock);
+  st->nintr = disk.nintr;
+  st->nnotify = disk.nnotify;
+  st->npolled = disk.npolled;
+  st->poll = disk.poll / (TIMEBASE / 1000000);
+  memmove(st->lat, disk.lat, sizeof(st->lat));
   release(&disk.vdisk_lock);
 }
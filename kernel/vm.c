@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -11,6 +13,12 @@
  */
 pagetable_t kernel_pagetable;
 
+// a page of zeros, mapped read-only copy-on-write wherever
+// a process reads heap memory it has never written.
+// the kernel keeps one reference, so it is never freed
+// or made writable.
+char *zeropage;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -54,6 +62,10 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+
+  if((zeropage = kalloc()) == 0)
+    panic("kvminit: zeropage");
+  memset(zeropage, 0, PGSIZE);
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -160,7 +172,8 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never faulted in (see
+// vmfault()) are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -173,9 +186,9 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -292,41 +305,222 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 }
 
 // Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// its memory from va to va+sz into a child's page table.
+// Copies only the page table: the physical pages
+// are shared.  Unless share is set, writable ones
+// are made read-only copy-on-write in both tables
+// (see cowfault()).
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 va, uint64 sz, int share)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  for(i = va; i < va + sz; i += PGSIZE){
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;  // never faulted in
+    if((*pte & PTE_W) && !share)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    kref((void*)pa);
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
+// Handle a write to user virtual address va in a
+// copy-on-write page: give pagetable its own writable
+// copy of the page, or just make the page writable
+// if no other page table shares it any more.
+// Returns 0 on success, -1 if va isn't a copy-on-write
+// page or there's no memory for the copy.
+int
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Return the segment of p's program file that holds
+// data for the page at va, or 0.
+static struct seg*
+findseg(struct proc *p, uint64 va)
+{
+  struct seg *s;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++)
+    if(va >= s->va && va < s->va + s->filesz)
+      return s;
+  return 0;
+}
+
+// Read the page at va of segment s in from p's program
+// file and map it.  Sleeps, so the caller must not hold
+// any spinlock.  Returns 0 on success, -1 on failure.
+static int
+segload(struct proc *p, struct seg *s, uint64 va)
+{
+  char *mem;
+  uint64 n;
+  int r;
+
+  n = s->filesz - (va - s->va);
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem + n, 0, PGSIZE - n);
+
+  ilock(p->execip);
+  r = readi(p->execip, 0, (uint64)mem, s->off + (va - s->va), n);
+  iunlock(p->execip);
+  if(r != n || mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Handle a page fault at user virtual address va in process p;
+// write is non-zero for a store.  Pages of p's memory that
+// are faulted in here:
+//  - pages of mmap()ed regions; see mmapfault().
+//  - pages of the program that exec() hasn't read yet
+//    are read from the program file.
+//  - other pages, such as bss or heap that sbrk() has grown
+//    but nothing has touched: a read maps the shared zero
+//    page copy-on-write, a write allocates a zeroed page.
+// Returns 0 if the access can be retried, -1 if it is an error.
+int
+vmfault(struct proc *p, uint64 va, int write)
+{
+  pte_t *pte;
+  char *mem;
+  struct seg *s;
+  struct vma *v;
+
+  if(va >= MAXVA)
+    return -1;
+  if((v = findvma(p, va)) != 0)
+    return mmapfault(p, v, va, write);
+  if(va >= p->sz)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write && (*pte & PTE_COW))
+      return cowfault(p->pagetable, va);
+    return -1;  // e.g. the stack guard page
+  }
+
+  if((s = findseg(p, va)) != 0)
+    return segload(p, s, va);
+
+  if(!write){
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)zeropage,
+                PTE_R|PTE_X|PTE_U|PTE_COW) != 0)
+      return -1;
+    kref(zeropage);
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Read in any pages of [va, va+len) that still have to come
+// from p's program file or an mmap()ed file.
+// System calls that copy to or from
+// user memory while holding a spinlock, or an inode lock,
+// call this first, since reading a page sleeps and locks the
+// program's inode.
+void
+vmprefault(struct proc *p, uint64 va, uint64 len)
+{
+  struct seg *s;
+  uint64 a, lo, hi;
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return;
+  if(len > MAXVA - va)
+    len = MAXVA - va;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    lo = va > s->va ? va : s->va;
+    hi = va + len < s->va + s->filesz ? va + len : s->va + s->filesz;
+    for(a = PGROUNDDOWN(lo); a < hi; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        segload(p, s, a);
+    }
+  }
+  mmapprefault(p, va, len);
+}
+
+// Look up user virtual address va for copyin() and friends,
+// and return the physical address of its page, or 0.
+// If pagetable is the current process's, a page that isn't
+// mapped yet (or, for a write, isn't writable yet: copy-on-write
+// or a clean shared mmap() page) is faulted in.
+static uint64
+uvmpage(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0)){
+    if(p == 0 || pagetable != p->pagetable || vmfault(p, va, write) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
+  if((*pte & PTE_U) == 0)
+    return 0;
+  return PTE2PA(*pte);
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -350,7 +544,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmpage(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -375,7 +569,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmpage(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -402,7 +596,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmpage(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
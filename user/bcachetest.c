@@ -0,0 +1,119 @@
+// Buffer cache contention benchmark.
+// Several processes read their own small files over and
+// over, so that with more than one CPU they are all in
+// bget()/brelse() at once.  Reports how often acquire()
+// had to spin on the buffer cache locks while they ran.
+// Run it with different CPUS= to see how contention scales.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define NCHILD  4
+#define NBLOCK  4    // blocks per file
+#define ROUNDS  200
+
+char buf[BSIZE];
+
+void
+mkname(char *name, int i)
+{
+  strcpy(name, "bcachetest.");
+  name[11] = '0' + i;
+  name[12] = 0;
+}
+
+void
+createfile(int i)
+{
+  char name[16];
+  int fd, b;
+
+  mkname(name, i);
+  fd = open(name, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("bcachetest: cannot create %s\n", name);
+    exit(1);
+  }
+  memset(buf, 'a' + i, sizeof(buf));
+  for(b = 0; b < NBLOCK; b++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("bcachetest: write %s failed\n", name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+void
+readfile(int i)
+{
+  char name[16];
+  int fd, r, b;
+
+  mkname(name, i);
+  for(r = 0; r < ROUNDS; r++){
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      printf("bcachetest: cannot open %s\n", name);
+      exit(1);
+    }
+    for(b = 0; b < NBLOCK; b++){
+      if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf("bcachetest: read %s failed\n", name);
+        exit(1);
+      }
+      if(buf[0] != 'a' + i){
+        printf("bcachetest: %s has wrong contents\n", name);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct lockstat before, after;
+  char name[16];
+  int i, t0, t1;
+
+  printf("bcachetest: %d processes, %d reads each\n", NCHILD, ROUNDS*NBLOCK);
+  for(i = 0; i < NCHILD; i++)
+    createfile(i);
+
+  if(lockstat("bcache", &before) < 0){
+    printf("bcachetest: lockstat failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("bcachetest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      readfile(i);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++)
+    wait(0);
+  t1 = uptime();
+  lockstat("bcache", &after);
+
+  printf("lock: bcache (%d locks): #acquire %l #spin %l\n", after.nlock,
+         after.nacquire - before.nacquire, after.nspin - before.nspin);
+  printf("bcachetest: %d ticks\n", t1 - t0);
+
+  for(i = 0; i < NCHILD; i++){
+    mkname(name, i);
+    unlink(name);
+  }
+  exit(0);
+}
@@ -1,35 +1,234 @@
 // Simple grep.  Only supports ^ . * $ operators.
+//
+// The pattern is compiled once into a list of atoms, each a
+// character or . with an optional *.  The NFA state "the first
+// i atoms have matched" is bit i of a set, and sets are turned
+// into DFA states lazily, as lines need them, so each byte of
+// input costs one table lookup.  A pattern with no operators
+// is instead searched for across the whole buffer with memchr()
+// or a Boyer-Moore-Horspool skip, and only the lines it is
+// found in are looked at.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[1024];
-int match(char*, char*);
+#define BUFSZ   16384
+#define MAXATOM 63      // atoms, plus the final state, fit in 64 bits
+#define NDSTATE 64      // cached DFA states
+#define ANY     256     // atom that matches any character
+
+struct atom {
+  int c;     // character, or ANY
+  int star;
+};
+
+struct dstate {
+  uint64 set;      // NFA states
+  short next[256]; // DFA state after each byte, or -1 if not known yet
+};
+
+char buf[BUFSZ+1];
+
+struct atom re[MAXATOM];
+int nre;
+int bol, eol;          // pattern starts with ^, ends with $
+uint64 final;          // bit of the matching NFA state
+uint64 start;          // NFA states before any input
+
+struct dstate dstates[NDSTATE];
+int ndstate;
+int dgen;              // bumped each time the cache is emptied
+
+char lit[MAXATOM];     // pattern without operators, or nlit = 0
+int nlit;
+int skip[256];         // Horspool shift for each byte
 
 void
-grep(char *pattern, int fd)
+compile(char *pattern)
+{
+  char *p;
+  int i;
+
+  p = pattern;
+  if(*p == '^'){
+    bol = 1;
+    p++;
+  }
+  for(; *p; p++){
+    if(p[0] == '$' && p[1] == '\0'){
+      eol = 1;
+      break;
+    }
+    if(nre == MAXATOM){
+      fprintf(2, "grep: pattern too long\n");
+      exit(1);
+    }
+    re[nre].c = *p == '.' ? ANY : (uchar)*p;
+    if(p[1] == '*'){
+      re[nre].star = 1;
+      p++;
+    }
+    nre++;
+  }
+  final = 1UL << nre;
+
+  if(!bol && !eol){
+    for(i = 0; i < nre && re[i].c != ANY && !re[i].star; i++)
+      lit[i] = re[i].c;
+    nlit = i == nre ? nre : 0;
+    for(i = 0; i < 256; i++)
+      skip[i] = nlit;
+    for(i = 0; i < nlit - 1; i++)
+      skip[(uchar)lit[i]] = nlit - 1 - i;
+  }
+}
+
+// Add the states reachable by skipping starred atoms.
+uint64
+closure(uint64 set)
+{
+  int i;
+
+  for(i = 0; i < nre; i++)
+    if((set & (1UL << i)) && re[i].star)
+      set |= 1UL << (i+1);
+  return set;
+}
+
+// NFA states after reading c in states set.
+uint64
+step(uint64 set, int c)
+{
+  uint64 next;
+  int i;
+
+  next = bol ? 0 : 1;  // unanchored: a match may start anywhere
+  for(i = 0; i < nre; i++){
+    if((set & (1UL << i)) == 0)
+      continue;
+    if(re[i].c == ANY || re[i].c == c)
+      next |= 1UL << (re[i].star ? i : i+1);
+  }
+  return closure(next);
+}
+
+// Index of the DFA state for set, adding it if need be.
+// When the cache is full it is emptied and started again.
+int
+dstate(uint64 set)
+{
+  struct dstate *d;
+  int i;
+
+  for(i = 0; i < ndstate; i++)
+    if(dstates[i].set == set)
+      return i;
+  if(ndstate == NDSTATE){
+    ndstate = 0;
+    dgen++;
+  }
+  d = &dstates[ndstate];
+  d->set = set;
+  memset(d->next, 0xff, sizeof(d->next));
+  return ndstate++;
+}
+
+// Does the line [s, e) match?
+int
+matchline(char *s, char *e)
+{
+  int d, nd, gen;
+  uint64 set;
+
+  d = dstate(start);
+  for(; s < e; s++){
+    set = dstates[d].set;
+    if(!eol && (set & final))
+      return 1;
+    if(set == 0)
+      return 0;  // anchored, and nothing left that can match
+    if((nd = dstates[d].next[(uchar)*s]) < 0){
+      gen = dgen;
+      nd = dstate(step(set, (uchar)*s));
+      if(dgen == gen)  // else d is gone
+        dstates[d].next[(uchar)*s] = nd;
+    }
+    d = nd;
+  }
+  return (dstates[d].set & final) != 0;
+}
+
+// First occurrence of lit in [s, e), or 0.
+char*
+findlit(char *s, char *e)
+{
+  char *p;
+  int i;
+
+  if(nlit == 1)
+    return memchr(s, lit[0], e - s);
+  for(p = s; p + nlit <= e; p += skip[(uchar)p[nlit-1]]){
+    for(i = nlit - 1; i >= 0 && p[i] == lit[i]; i--)
+      ;
+    if(i < 0)
+      return p;
+  }
+  return 0;
+}
+
+// Print the matching lines of [s, e), which ends with a newline.
+void
+scan(char *s, char *e)
 {
-  int n, m;
   char *p, *q;
 
+  if(nlit > 0){
+    while(s < e && (p = findlit(s, e)) != 0){
+      for(q = p; q > s && q[-1] != '\n'; q--)
+        ;
+      p = memchr(p, '\n', e - p);
+      write(1, q, p+1 - q);
+      s = p+1;
+    }
+    return;
+  }
+  for(; s < e; s = p+1){
+    p = memchr(s, '\n', e - s);
+    if(matchline(s, p))
+      write(1, s, p+1 - s);
+  }
+}
+
+void
+grep(int fd)
+{
+  int n, m;
+  char *p;
+
   m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
+  while((n = read(fd, buf+m, BUFSZ-m)) > 0){
     m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
+    // the last newline in buf ends the lines we can scan now.
+    for(p = buf+m; p > buf && p[-1] != '\n'; p--)
+      ;
+    if(p == buf){
+      if(m == BUFSZ){
+        // a line longer than the buffer is cut in pieces.
+        buf[m] = '\n';
+        scan(buf, buf+m+1);
+        m = 0;
       }
-      p = q+1;
-    }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+      continue;
     }
+    scan(buf, p);
+    m -= p - buf;
+    memmove(buf, p, m);
+  }
+  if(m > 0){
+    // last line without a newline.
+    buf[m] = '\n';
+    scan(buf, buf+m+1);
   }
 }
 
@@ -37,16 +236,16 @@ int
 main(int argc, char *argv[])
 {
   int fd, i;
-  char *pattern;
 
   if(argc <= 1){
     fprintf(2, "usage: grep pattern [file ...]\n");
     exit(1);
   }
-  pattern = argv[1];
+  compile(argv[1]);
+  start = closure(1);
 
   if(argc <= 2){
-    grep(pattern, 0);
+    grep(0);
     exit(0);
   }
 
@@ -55,51 +254,8 @@ main(int argc, char *argv[])
       printf("grep: cannot open %s\n", argv[i]);
       exit(1);
     }
-    grep(pattern, fd);
+    grep(fd);
     close(fd);
   }
   exit(0);
 }
-
-// Regexp matcher from Kernighan & Pike,
-// The Practice of Programming, Chapter 9.
-
-int matchhere(char*, char*);
-int matchstar(int, char*, char*);
-
-int
-match(char *re, char *text)
-{
-  if(re[0] == '^')
-    return matchhere(re+1, text);
-  do{  // must look at empty string
-    if(matchhere(re, text))
-      return 1;
-  }while(*text++ != '\0');
-  return 0;
-}
-
-// matchhere: search for re at beginning of text
-int matchhere(char *re, char *text)
-{
-  if(re[0] == '\0')
-    return 1;
-  if(re[1] == '*')
-    return matchstar(re[0], re+2, text);
-  if(re[0] == '$' && re[1] == '\0')
-    return *text == '\0';
-  if(*text!='\0' && (re[0]=='.' || re[0]==*text))
-    return matchhere(re+1, text+1);
-  return 0;
-}
-
-// matchstar: search for c*re at beginning of text
-int matchstar(int c, char *re, char *text)
-{
-  do{  // a * matches zero or more instances
-    if(matchhere(re, text))
-      return 1;
-  }while(*text!='\0' && (*text++==c || c=='.'));
-  return 0;
-}
-
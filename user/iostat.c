@@ -0,0 +1,87 @@
+// Print the block I/O queue's statistics: how many blocks
+// were queued, how many disk requests they went out in, and
+// how many requests missed their deadline, and how many
+// interrupts and notifications passed between driver and disk,
+// and a histogram of how long waits for the disk took, for
+// comparing the driver's interrupt and polled modes.
+// iostat cmd args... prints them for just that command.
+// iostat -p us [cmd args...] first sets the driver to poll for
+// up to us microseconds (at most 2000), or, with 0, to rely on
+// interrupts.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/blkstat.h"
+#include "user/user.h"
+
+void
+get(struct blkstat *st)
+{
+  if(blkstat(st) < 0){
+    fprintf(2, "iostat: blkstat failed\n");
+    exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct blkstat st0, st;
+  int pid, k;
+
+  if(argc > 2 && strcmp(argv[1], "-p") == 0){
+    if(diskpoll(atoi(argv[2])) < 0){
+      fprintf(2, "iostat: diskpoll failed\n");
+      exit(1);
+    }
+    argc -= 2;
+    argv += 2;
+  }
+
+  memset(&st0, 0, sizeof(st0));
+  if(argc > 1){
+    get(&st0);
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "iostat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      fprintf(2, "iostat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  get(&st);
+
+  printf("blocks %l, requests %l, merged %l, late %l, max queued %d\n",
+         st.nbuf - st0.nbuf, st.nreq - st0.nreq,
+         st.nmerged - st0.nmerged, st.nlate - st0.nlate, st.maxqueue);
+  printf("interrupts %l, notifications %l, polled %l\n",
+         st.nintr - st0.nintr, st.nnotify - st0.nnotify,
+         st.npolled - st0.npolled);
+  if(st.nreq > st0.nreq){
+    printf("%l.%l blocks per request\n",
+           (st.nbuf - st0.nbuf) / (st.nreq - st0.nreq),
+           (st.nbuf - st0.nbuf) * 10 / (st.nreq - st0.nreq) % 10);
+    printf("%l.%l interrupts per request\n",
+           (st.nintr - st0.nintr) / (st.nreq - st0.nreq),
+           (st.nintr - st0.nintr) * 10 / (st.nreq - st0.nreq) % 10);
+  }
+
+  if(st.poll)
+    printf("wait latency, polled mode (%l us):\n", st.poll);
+  else
+    printf("wait latency, interrupt mode:\n");
+  for(k = 0; k < NLAT; k++){
+    if(st.lat[k] == st0.lat[k])
+      continue;
+    if(k == NLAT-1)
+      printf("  %d us and up: %l\n", 1 << k, st.lat[k] - st0.lat[k]);
+    else
+      printf("  %d-%d us: %l\n", k ? 1 << k : 0, (1 << (k+1)) - 1,
+             st.lat[k] - st0.lat[k]);
+  }
+  exit(0);
+}
@@ -0,0 +1,194 @@
+// Physical page allocator stress test.
+// test1 has several processes allocate and free pages
+// at once and reports how often acquire() had to spin
+// on the kmem locks; run it before and after a kalloc
+// change, or with different CPUS=, to compare.
+// test2 checks that no pages go missing when they
+// move between CPUs' free lists.
+// test3 checks that the buddy allocator merges freed
+// pages back into large blocks, and prints its free
+// block counts.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+#define NCHILD 4
+#define N      10000
+#define SZ     4096
+
+void
+getstat(struct lockstat *st)
+{
+  if(lockstat("kmem", st) < 0){
+    printf("kalloctest: lockstat failed\n");
+    exit(1);
+  }
+}
+
+void
+test1(void)
+{
+  struct lockstat before, after;
+  int i, j, t0, t1;
+  char *a;
+
+  printf("start test1\n");
+  getstat(&before);
+  t0 = uptime();
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j < N; j++){
+        a = sbrk(SZ);
+        if(a == (char*)-1){
+          printf("sbrk failed\n");
+          exit(1);
+        }
+        *(int *)(a+4) = 1;   // make sure the page is really there
+        if(sbrk(-SZ) == (char*)-1){
+          printf("sbrk(-) failed\n");
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++)
+    wait(0);
+  t1 = uptime();
+  getstat(&after);
+
+  printf("lock: kmem (%d locks): #acquire %l #spin %l\n", after.nlock,
+         after.nacquire - before.nacquire, after.nspin - before.nspin);
+  printf("test1 done: %d ticks\n", t1 - t0);
+}
+
+// Allocate and touch pages until sbrk fails.
+// Returns the number of pages allocated.
+int
+countfree(void)
+{
+  int n = 0;
+  char *a;
+
+  while((a = sbrk(SZ)) != (char*)-1){
+    *(int *)(a+4) = 1;
+    n++;
+  }
+  return n;
+}
+
+// Run countfree() in a child, so that its memory
+// is freed again when it exits.
+int
+childcount(void)
+{
+  int fds[2], n;
+
+  if(pipe(fds) < 0){
+    printf("pipe failed\n");
+    exit(1);
+  }
+  int pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    n = countfree();
+    write(fds[1], &n, sizeof(n));
+    exit(0);
+  }
+  close(fds[1]);
+  if(read(fds[0], &n, sizeof(n)) != sizeof(n)){
+    printf("read failed\n");
+    exit(1);
+  }
+  close(fds[0]);
+  wait(0);
+  return n;
+}
+
+void
+test2(void)
+{
+  int n0, n;
+
+  printf("start test2\n");
+  n0 = childcount();
+  for(int i = 0; i < 5; i++){
+    n = childcount();
+    if(n != n0){
+      printf("test2 FAILED: %d free pages, expected %d\n", n, n0);
+      exit(1);
+    }
+  }
+  printf("test2 OK: %d free pages\n", n0);
+}
+
+void
+getmemstat(struct memstat *st)
+{
+  if(memstat(st) < 0){
+    printf("kalloctest: memstat failed\n");
+    exit(1);
+  }
+}
+
+// Free pages, whether in buddy blocks or on per-CPU lists.
+int
+totalfree(struct memstat *st)
+{
+  int n = st->ncached;
+
+  for(int k = 0; k < NORDER; k++)
+    n += st->nfree[k] << k;
+  return n;
+}
+
+void
+test3(void)
+{
+  struct memstat before, after;
+  int k;
+
+  printf("start test3\n");
+  getmemstat(&before);
+  childcount();
+  getmemstat(&after);
+
+  printf("free blocks by order:");
+  for(k = 0; k < NORDER; k++)
+    printf(" %d", after.nfree[k]);
+  printf("\ncached pages %d, splits %d, merges %d\n", after.ncached,
+         (int)(after.nsplit - before.nsplit), (int)(after.nmerge - before.nmerge));
+  if(totalfree(&after) != totalfree(&before)){
+    printf("test3 FAILED: %d free pages, expected %d\n",
+           totalfree(&after), totalfree(&before));
+    exit(1);
+  }
+  // all of memory was allocated one page at a time and freed;
+  // most of it must have merged back into the largest blocks.
+  if((after.nfree[NORDER-1] << (NORDER-1)) < totalfree(&after) / 2){
+    printf("test3 FAILED: free memory did not merge\n");
+    exit(1);
+  }
+  printf("test3 OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  test1();
+  test2();
+  test3();
+  exit(0);
+}
@@ -22,52 +22,46 @@ fmtname(char *path)
   return buf;
 }
 
+// Directory entries read per getdents() call.
+#define NENT 64
+
 void
 ls(char *path)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  static struct direntplus ents[NENT];
+  char name[DIRSIZ+1];
+  int fd, i, n;
   struct stat st;
 
-  if((fd = open(path, 0)) < 0){
+  if(stat(path, &st) < 0){
     fprintf(2, "ls: cannot open %s\n", path);
     return;
   }
 
-  if(fstat(fd, &st) < 0){
-    fprintf(2, "ls: cannot stat %s\n", path);
-    close(fd);
-    return;
-  }
-
   switch(st.type){
   case T_FILE:
     printf("%s %d %d %l\n", fmtname(path), st.type, st.ino, st.size);
     break;
 
   case T_DIR:
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
-      printf("ls: path too long\n");
+    if((fd = open(path, 0)) < 0){
+      fprintf(2, "ls: cannot open %s\n", path);
       break;
     }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
+    while((n = getdents(fd, ents, NENT, 1)) > 0){
+      for(i = 0; i < n; i++){
+        memmove(name, ents[i].name, DIRSIZ);
+        name[DIRSIZ] = 0;
+        if(ents[i].type == 0){
+          printf("ls: cannot stat %s/%s\n", path, name);
+          continue;
+        }
+        printf("%s %d %d %d\n", fmtname(name), ents[i].type, ents[i].inum, ents[i].size);
       }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
     }
+    close(fd);
     break;
   }
-  close(fd);
 }
 
 int
@@ -0,0 +1,194 @@
+// malloc() benchmark.
+// Runs the same random mix of malloc() and free() calls, mostly
+// small sizes with a few large ones, against the library's
+// size-class allocator and against the K&R first-fit allocator
+// it replaced (copied below), each in its own child process.
+// Reports operations per second, how far the heap grew, and
+// how much memory the child used (its resident heap pages,
+// which sbrk() only allocates when touched), from the drop in
+// free physical pages.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+#define NSLOT 1000
+#define NOPS  200000
+
+// The old K&R allocator, renamed.
+
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+
+void
+krfree(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+static Header*
+morecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  krfree((void*)(hp + 1));
+  return freep;
+}
+
+void*
+krmalloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = morecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+static uint seed;
+
+static uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) & 0xffffff;
+}
+
+// Random size: mostly small, sometimes up to 16KB.
+static uint
+randsize(void)
+{
+  uint r = rand();
+
+  if(r % 64 == 0)
+    return 4096 + (r >> 6) % 12288;
+  return 8 + (r >> 6) % 248;
+}
+
+// Free physical pages, whether in buddy blocks or cached.
+int
+freepages(void)
+{
+  struct memstat st;
+  int n;
+
+  if(memstat(&st) < 0){
+    printf("mallocbench: memstat failed\n");
+    exit(1);
+  }
+  n = st.ncached;
+  for(int k = 0; k < NORDER; k++)
+    n += st.nfree[k] << k;
+  return n;
+}
+
+void
+run(char *name, void *(*alloc)(uint), void (*release)(void*))
+{
+  static char *slot[NSLOT];
+  char *start;
+  int i, j, pid, t0, t1, free0;
+  uint sz;
+
+  pid = fork();
+  if(pid < 0){
+    printf("mallocbench: fork failed\n");
+    exit(1);
+  }
+  if(pid > 0){
+    wait(0);
+    return;
+  }
+
+  seed = 1;
+  start = sbrk(0);
+  free0 = freepages();
+  t0 = uptime();
+  for(i = 0; i < NOPS; i++){
+    j = rand() % NSLOT;
+    if(slot[j]){
+      release(slot[j]);
+      slot[j] = 0;
+    } else {
+      sz = randsize();
+      if((slot[j] = alloc(sz)) == 0){
+        printf("mallocbench: %s: out of memory\n", name);
+        exit(1);
+      }
+      slot[j][0] = slot[j][sz-1] = 1;
+    }
+  }
+  t1 = uptime();
+  if(t1 == t0)
+    t1 = t0 + 1;
+  // a tick is about 1/10 second.
+  printf("%s: %d ops in %d ticks, %d ops/sec\n",
+         name, NOPS, t1 - t0, NOPS * 10 / (t1 - t0));
+  printf("  heap grew %d KB, %d KB resident\n",
+         (int)((sbrk(0) - start) / 1024), (free0 - freepages()) * 4);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  run("size-class malloc", malloc, free);
+  run("K&R malloc", krmalloc, krfree);
+  exit(0);
+}
@@ -0,0 +1,71 @@
+// Pipe bandwidth benchmark.
+// A child writes through a pipe to its parent, using the
+// same buffer size on both ends, and the parent reports
+// the bandwidth for each size in MB/s.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define MB (1024*1024)
+
+char buf[16384];
+
+void
+run(int sz, int total)
+{
+  int fds[2], pid, n, got, t0, t1;
+  uint64 rate;
+
+  if(pipe(fds) < 0){
+    printf("pipebench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf("pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(n = 0; n < total; n += sz){
+      if(write(fds[1], buf, sz) != sz){
+        printf("pipebench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  got = 0;
+  while((n = read(fds[0], buf, sz)) > 0)
+    got += n;
+  close(fds[0]);
+  wait(0);
+  t1 = uptime();
+
+  if(got != total){
+    printf("pipebench: read %d bytes, expected %d\n", got, total);
+    exit(1);
+  }
+  if(t1 == t0)
+    t1 = t0 + 1;
+  // a tick is about 1/10 second; report hundredths of MB/s.
+  rate = (uint64)total * 10 * 100 / MB / (t1 - t0);
+  printf("%d byte transfers: %d KB in %d ticks, %d.%d%d MB/s\n",
+         sz, total / 1024, t1 - t0, (int)(rate / 100),
+         (int)(rate / 10 % 10), (int)(rate % 10));
+}
+
+int
+main(int argc, char *argv[])
+{
+  memset(buf, 'x', sizeof(buf));
+  run(1, MB/8);
+  run(64, 2*MB);
+  run(512, 16*MB);
+  run(4096, 32*MB);
+  run(sizeof(buf), 32*MB);
+  exit(0);
+}
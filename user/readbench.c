@@ -0,0 +1,99 @@
+// File read benchmark.
+// Writes a file as big as a file can be, then reads it from
+// start to end several times, which the kernel reads ahead
+// of, and as often again in a random block order, which it
+// can't, and prints KB/s and the disk requests each took.
+// The file is much bigger than the buffer cache, so each
+// pass reads it from the disk again.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/blkstat.h"
+#include "user/user.h"
+
+#define NPASS 20
+#define CHUNK 4096   // bytes per sequential read
+
+char buf[CHUNK];
+int order[MAXFILE];
+
+static uint seed = 1;
+
+static uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) & 0xffffff;
+}
+
+void
+report(char *name, int t, struct blkstat *st0, struct blkstat *st)
+{
+  if(t == 0)
+    t = 1;
+  // a tick is about 1/10 second.
+  printf("%s: %d KB/s, %l requests for %l blocks\n", name,
+         NPASS * MAXFILE * (BSIZE / 1024) * 10 / t,
+         st->nreq - st0->nreq, st->nbuf - st0->nbuf);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct blkstat st0, st;
+  int fd, i, j, k, t0, n;
+
+  unlink("readbench.tmp");
+  fd = open("readbench.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("readbench: create failed\n");
+    exit(1);
+  }
+  for(i = 0; i < MAXFILE; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("readbench: write failed\n");
+      exit(1);
+    }
+  }
+
+  blkstat(&st0);
+  t0 = uptime();
+  for(i = 0; i < NPASS; i++){
+    for(j = 0; j < MAXFILE * BSIZE; j += n){
+      if((n = pread(fd, buf, CHUNK, j)) <= 0){
+        printf("readbench: read failed\n");
+        exit(1);
+      }
+    }
+  }
+  blkstat(&st);
+  report("sequential", uptime() - t0, &st0, &st);
+
+  for(i = 0; i < MAXFILE; i++)
+    order[i] = i;
+  blkstat(&st0);
+  t0 = uptime();
+  for(i = 0; i < NPASS; i++){
+    for(j = MAXFILE - 1; j > 0; j--){
+      k = rand() % (j + 1);
+      n = order[j];
+      order[j] = order[k];
+      order[k] = n;
+    }
+    for(j = 0; j < MAXFILE; j++){
+      if(pread(fd, buf, BSIZE, order[j] * BSIZE) != BSIZE){
+        printf("readbench: read failed\n");
+        exit(1);
+      }
+    }
+  }
+  blkstat(&st);
+  report("random", uptime() - t0, &st0, &st);
+
+  close(fd);
+  unlink("readbench.tmp");
+  exit(0);
+}
@@ -0,0 +1,183 @@
+// Buffered output and input on file descriptors.
+//
+// Each fd has an output buffer, used by putc() and so by
+// printf() and fprintf().  Output to a console is line
+// buffered, output to fd 2 is not buffered at all, and output
+// to files and pipes is written a buffer at a time.  Buffers
+// are flushed by fflush(), and by close(), fork(), exec() and
+// exit(), which are wrapped here so that nothing is lost or
+// printed twice.
+//
+// fgets() reads a line from a console through a per-fd input
+// buffer instead of one read() per byte; a console read stops
+// at the end of a line anyway.  Files and pipes are still read
+// a byte at a time, so that fgets() takes no more than the
+// line, and a program run by sh < script gets the rest.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define BUFSIZE 512
+
+enum { UNSET, UNBUF, LINEBUF, FULLBUF };
+
+struct outbuf {
+  int mode;
+  int n;
+  char buf[BUFSIZE];
+};
+
+struct inbuf {
+  int mode;  // UNSET, UNBUF, or LINEBUF for a console
+  int r;  // next byte to return
+  int n;  // bytes in buf
+  char buf[BUFSIZE];
+};
+
+static struct outbuf out[NOFILE];
+static struct inbuf in[NOFILE];
+
+static struct outbuf*
+outbuf(int fd)
+{
+  struct outbuf *ob;
+  struct stat st;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  ob = &out[fd];
+  if(ob->mode == UNSET){
+    if(fd == 2)
+      ob->mode = UNBUF;
+    else if(fstat(fd, &st) == 0 && st.type == T_DEVICE)
+      ob->mode = LINEBUF;
+    else
+      ob->mode = FULLBUF;  // file, or pipe (fstat fails)
+  }
+  return ob;
+}
+
+// Write out fd's buffered output.
+// Returns 0, or -1 if the write failed.
+int
+fflush(int fd)
+{
+  struct outbuf *ob;
+  int i, n;
+
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  ob = &out[fd];
+  for(i = 0; i < ob->n; i += n){
+    if((n = write(fd, ob->buf + i, ob->n - i)) <= 0){
+      ob->n = 0;
+      return -1;
+    }
+  }
+  ob->n = 0;
+  return 0;
+}
+
+static void
+flushall(int linebufonly)
+{
+  for(int fd = 0; fd < NOFILE; fd++)
+    if(out[fd].n > 0 && (!linebufonly || out[fd].mode == LINEBUF))
+      fflush(fd);
+}
+
+void
+putc(int fd, char c)
+{
+  struct outbuf *ob;
+
+  if((ob = outbuf(fd)) == 0 || ob->mode == UNBUF){
+    write(fd, &c, 1);
+    return;
+  }
+  ob->buf[ob->n++] = c;
+  if(ob->n == BUFSIZE || (ob->mode == LINEBUF && c == '\n'))
+    fflush(fd);
+}
+
+// Read a line from fd into buf, up to max-1 bytes,
+// including the \n or \r that ends it.
+// Returns buf, or 0 if there was nothing left to read.
+char*
+fgets(char *buf, int max, int fd)
+{
+  struct inbuf *ib;
+  struct stat st;
+  int i;
+  char c;
+
+  if(fd < 0 || fd >= NOFILE || max < 1)
+    return 0;
+  ib = &in[fd];
+  if(ib->mode == UNSET){
+    if(fstat(fd, &st) == 0 && st.type == T_DEVICE)
+      ib->mode = LINEBUF;
+    else
+      ib->mode = UNBUF;
+  }
+  for(i = 0; i+1 < max; ){
+    if(ib->r == ib->n){
+      // show any prompt before waiting for input.
+      flushall(1);
+      ib->r = 0;
+      if((ib->n = read(fd, ib->buf, ib->mode == LINEBUF ? sizeof(ib->buf) : 1)) <= 0){
+        ib->n = 0;
+        break;
+      }
+    }
+    c = ib->buf[ib->r++];
+    buf[i++] = c;
+    if(c == '\n' || c == '\r')
+      break;
+  }
+  buf[i] = '\0';
+  return i > 0 ? buf : 0;
+}
+
+char*
+gets(char *buf, int max)
+{
+  if(fgets(buf, max, 0) == 0)
+    buf[0] = '\0';
+  return buf;
+}
+
+int
+close(int fd)
+{
+  if(fd >= 0 && fd < NOFILE){
+    fflush(fd);
+    out[fd].mode = UNSET;
+    in[fd].mode = UNSET;
+    in[fd].r = in[fd].n = 0;
+  }
+  return _close(fd);
+}
+
+int
+fork(void)
+{
+  flushall(0);
+  return _fork();
+}
+
+int
+exit(int status)
+{
+  flushall(0);
+  _exit(status);
+}
+
+int
+exec(char *path, char **argv)
+{
+  flushall(0);
+  return _exec(path, argv);
+}
@@ -3,6 +3,19 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
+// The memory and string routines work a 64-bit word at a time
+// once their pointers are aligned.  A word-sized load of a
+// string may read past its terminating 0, but never past the
+// aligned word holding it, so never into another page.
+
+#define WSIZE 8
+#define WMASK (WSIZE - 1)
+#define ONES  0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+
+// Non-zero if some byte of w is 0.
+#define HASZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -17,6 +30,20 @@ strcpy(char *s, const char *t)
 int
 strcmp(const char *p, const char *q)
 {
+  const uint64 *wp, *wq;
+
+  if((((uint64)p ^ (uint64)q) & WMASK) == 0){
+    for(; ((uint64)p & WMASK) != 0; p++, q++)
+      if(*p == 0 || *p != *q)
+        return (uchar)*p - (uchar)*q;
+    // skip equal words without a 0; the bytes below finish.
+    wp = (const uint64*)p;
+    wq = (const uint64*)q;
+    while(*wp == *wq && !HASZERO(*wp))
+      wp++, wq++;
+    p = (const char*)wp;
+    q = (const char*)wq;
+  }
   while(*p && *p == *q)
     p++, q++;
   return (uchar)*p - (uchar)*q;
@@ -25,63 +52,71 @@ strcmp(const char *p, const char *q)
 uint
 strlen(const char *s)
 {
-  int n;
+  const char *p;
+  const uint64 *w;
 
-  for(n = 0; s[n]; n++)
+  for(p = s; ((uint64)p & WMASK) != 0; p++)
+    if(*p == 0)
+      return p - s;
+  for(w = (const uint64*)p; !HASZERO(*w); w++)
     ;
-  return n;
+  for(p = (const char*)w; *p; p++)
+    ;
+  return p - s;
 }
 
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uchar *d = dst;
+  uint64 w, *wd;
+
+  for(; n > 0 && ((uint64)d & WMASK) != 0; n--)
+    *d++ = c;
+  if(n >= WSIZE){
+    w = (uchar)c * ONES;
+    wd = (uint64*)d;
+    for(; n >= 4*WSIZE; n -= 4*WSIZE, wd += 4){
+      wd[0] = w;
+      wd[1] = w;
+      wd[2] = w;
+      wd[3] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = w;
+    d = (uchar*)wd;
   }
+  while(n-- > 0)
+    *d++ = c;
   return dst;
 }
 
 char*
 strchr(const char *s, char c)
 {
-  for(; *s; s++)
+  const uint64 *w;
+  uint64 cs;
+
+  for(; ((uint64)s & WMASK) != 0; s++){
     if(*s == c)
       return (char*)s;
-  return 0;
-}
-
-char*
-gets(char *buf, int max)
-{
-  int i, cc;
-  char c;
-
-  for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
-      break;
-    buf[i++] = c;
-    if(c == '\n' || c == '\r')
-      break;
+    if(*s == 0)
+      return 0;
   }
-  buf[i] = '\0';
-  return buf;
+  // skip words with neither c nor 0 in them.
+  cs = (uchar)c * ONES;
+  for(w = (const uint64*)s; !HASZERO(*w) && !HASZERO(*w ^ cs); w++)
+    ;
+  for(s = (const char*)w; *s; s++)
+    if(*s == c)
+      return (char*)s;
+  return 0;
 }
 
 int
 stat(const char *n, struct stat *st)
 {
-  int fd;
-  int r;
-
-  fd = open(n, O_RDONLY);
-  if(fd < 0)
-    return -1;
-  r = fstat(fd, st);
-  close(fd);
-  return r;
+  return fstatat(AT_FDCWD, n, st);
 }
 
 int
@@ -95,20 +130,72 @@ atoi(const char *s)
   return n;
 }
 
+// Copy n bytes forward from src to dst.
+// Safe for overlapping buffers only if dst is below src.
+static void
+copyfwd(uchar *d, const uchar *s, uint n)
+{
+  uint64 *wd, prev, next;
+  const uint64 *ws;
+  int lo, hi;
+
+  for(; n > 0 && ((uint64)d & WMASK) != 0; n--)
+    *d++ = *s++;
+  if(n >= WSIZE){
+    wd = (uint64*)d;
+    if(((uint64)s & WMASK) == 0){
+      ws = (const uint64*)s;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, wd += 4, ws += 4){
+        wd[0] = ws[0];
+        wd[1] = ws[1];
+        wd[2] = ws[2];
+        wd[3] = ws[3];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      s = (const uchar*)ws;
+    } else {
+      // misaligned s: shift aligned words together.
+      lo = ((uint64)s & WMASK) * 8;
+      hi = 64 - lo;
+      ws = (const uint64*)((uint64)s & ~WMASK);
+      prev = *ws++;
+      for(; n >= WSIZE; n -= WSIZE, s += WSIZE){
+        next = *ws++;
+        *wd++ = (prev >> lo) | (next << hi);
+        prev = next;
+      }
+    }
+    d = (uchar*)wd;
+  }
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
 void*
 memmove(void *vdst, const void *vsrc, int n)
 {
-  char *dst;
-  const char *src;
+  uchar *dst;
+  const uchar *src;
 
   dst = vdst;
   src = vsrc;
-  if (src > dst) {
-    while(n-- > 0)
-      *dst++ = *src++;
+  if(n <= 0)
+    return vdst;
+  if (src > dst || src + n <= dst) {
+    copyfwd(dst, src, n);
   } else {
     dst += n;
     src += n;
+    if((((uint64)src ^ (uint64)dst) & WMASK) == 0){
+      for(; n > 0 && ((uint64)dst & WMASK) != 0; n--)
+        *--dst = *--src;
+      for(; n >= WSIZE; n -= WSIZE){
+        dst -= WSIZE;
+        src -= WSIZE;
+        *(uint64*)dst = *(const uint64*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -119,6 +206,16 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+
+  if((((uint64)p1 ^ (uint64)p2) & WMASK) == 0){
+    for(; n > 0 && ((uint64)p1 & WMASK) != 0; n--, p1++, p2++)
+      if(*p1 != *p2)
+        return *p1 - *p2;
+    // skip equal words; the bytes below find the difference.
+    for(; n >= WSIZE; n -= WSIZE, p1 += WSIZE, p2 += WSIZE)
+      if(*(const uint64*)p1 != *(const uint64*)p2)
+        break;
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -132,5 +229,26 @@ memcmp(const void *s1, const void *s2, uint n)
 void *
 memcpy(void *dst, const void *src, uint n)
 {
-  return memmove(dst, src, n);
+  copyfwd(dst, src, n);
+  return dst;
+}
+
+void*
+memchr(const void *s, int c, uint n)
+{
+  const uchar *p = s;
+  const uint64 *w;
+  uint64 cs;
+
+  for(; n > 0 && ((uint64)p & WMASK) != 0; n--, p++)
+    if(*p == (uchar)c)
+      return (void*)p;
+  // skip words without c in them.
+  cs = (uchar)c * ONES;
+  for(w = (const uint64*)p; n >= WSIZE && !HASZERO(*w ^ cs); n -= WSIZE)
+    w++;
+  for(p = (const uchar*)w; n > 0; n--, p++)
+    if(*p == (uchar)c)
+      return (void*)p;
+  return 0;
 }
@@ -0,0 +1,173 @@
+// ulib string and memory routine benchmark.
+// Times the library's word-at-a-time routines against the
+// byte loops they replaced (copied below), for a few sizes,
+// and prints the throughput of each in MB/s.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define MB    (1024*1024)
+#define TOTAL (8*MB)   // bytes per measurement
+
+// The old byte-at-a-time versions.
+
+void*
+oldmemset(void *dst, int c, uint n)
+{
+  char *cdst = (char *) dst;
+  int i;
+  for(i = 0; i < n; i++){
+    cdst[i] = c;
+  }
+  return dst;
+}
+
+void*
+oldmemmove(void *vdst, const void *vsrc, int n)
+{
+  char *dst;
+  const char *src;
+
+  dst = vdst;
+  src = vsrc;
+  if (src > dst) {
+    while(n-- > 0)
+      *dst++ = *src++;
+  } else {
+    dst += n;
+    src += n;
+    while(n-- > 0)
+      *--dst = *--src;
+  }
+  return vdst;
+}
+
+int
+oldmemcmp(const void *s1, const void *s2, uint n)
+{
+  const char *p1 = s1, *p2 = s2;
+  while (n-- > 0) {
+    if (*p1 != *p2) {
+      return *p1 - *p2;
+    }
+    p1++;
+    p2++;
+  }
+  return 0;
+}
+
+int
+oldstrcmp(const char *p, const char *q)
+{
+  while(*p && *p == *q)
+    p++, q++;
+  return (uchar)*p - (uchar)*q;
+}
+
+uint
+oldstrlen(const char *s)
+{
+  int n;
+
+  for(n = 0; s[n]; n++)
+    ;
+  return n;
+}
+
+char*
+oldstrchr(const char *s, char c)
+{
+  for(; *s; s++)
+    if(*s == c)
+      return (char*)s;
+  return 0;
+}
+
+char a[4096+8], b[4096+8];
+int sink;
+
+enum { MEMSET, MEMCPY, MEMMOVE, MEMCMP, STRLEN, STRCMP, STRCHR, NOP };
+char *names[] = {
+  [MEMSET]  "memset ",
+  [MEMCPY]  "memcpy ",
+  [MEMMOVE] "memmove",
+  [MEMCMP]  "memcmp ",
+  [STRLEN]  "strlen ",
+  [STRCMP]  "strcmp ",
+  [STRCHR]  "strchr ",
+};
+
+// Run op on n-byte buffers until TOTAL bytes are done,
+// with the new routine if new is set, else the old one.
+// Returns the number of ticks taken.
+int
+run(int op, int n, int new)
+{
+  int i, iters, t0;
+
+  iters = TOTAL / n;
+  t0 = uptime();
+  for(i = 0; i < iters; i++){
+    switch(op){
+    case MEMSET:
+      new ? memset(a, i, n) : oldmemset(a, i, n);
+      break;
+    case MEMCPY:
+      new ? memcpy(a, b + 1, n) : oldmemmove(a, b + 1, n);
+      break;
+    case MEMMOVE:
+      new ? memmove(a + 1, a, n) : oldmemmove(a + 1, a, n);
+      break;
+    case MEMCMP:
+      sink += new ? memcmp(a, b, n) : oldmemcmp(a, b, n);
+      break;
+    case STRLEN:
+      sink += new ? strlen(b) : oldstrlen(b);
+      break;
+    case STRCMP:
+      sink += new ? strcmp(a, b) : oldstrcmp(a, b);
+      break;
+    case STRCHR:
+      sink += (new ? strchr(b, 'y') : oldstrchr(b, 'y')) != 0;
+      break;
+    }
+  }
+  return uptime() - t0;
+}
+
+// Print MB/s, given that TOTAL bytes took t ticks of
+// about 1/10 second.
+void
+rate(int t)
+{
+  if(t == 0)
+    t = 1;
+  printf(" %d MB/s", TOTAL * 10 / MB / t);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static int sizes[] = { 16, 256, 4096 };
+  int op, i, n;
+
+  printf("ulibbench: old vs new, MB/s\n");
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    n = sizes[i];
+    // equal strings of n-1 bytes, for the compares.
+    memset(b, 'x', n - 1);
+    b[n - 1] = 0;
+    memmove(a, b, n);
+    for(op = 0; op < NOP; op++){
+      printf("%s %d:", names[op], n);
+      rate(run(op, n, 0));
+      printf(" ->");
+      rate(run(op, n, 1));
+      printf("\n");
+      // memset and memmove clobber a.
+      memmove(a, b, n);
+    }
+  }
+  exit(0);
+}
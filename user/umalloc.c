@@ -3,88 +3,154 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Size-class memory allocator.
+//
+// Every block starts with a header giving its size class.
+// Small blocks (up to 2048 bytes, header included) are rounded
+// up to one of NSMALL sizes, and each size has its own free
+// list, refilled by carving up a CHUNK from sbrk().  Larger
+// blocks are rounded up to a power of two, with a free list
+// per power, and come straight from sbrk().  So malloc() and
+// free() only ever push or pop one list.  Freed memory is kept
+// for blocks of the same class; it is not merged or given back.
+
+#define CHUNK   4096
+#define NSMALL  16
+#define NLARGE  19                 // up to 2^(LARGE0+NLARGE-1) bytes
+#define LARGE0  12                 // smallest large block is 4096
 
 typedef long Align;
 
 union header {
   struct {
-    union header *ptr;
-    uint size;
+    union header *next;  // on free list
+    int cls;             // size class
   } s;
   Align x;
 };
 
 typedef union header Header;
 
-static Header base;
-static Header *freep;
+static uint small[NSMALL] = {
+  16, 32, 48, 64, 80, 96, 112, 128,
+  192, 256, 384, 512, 768, 1024, 1536, 2048,
+};
 
-void
-free(void *ap)
+static Header *freelist[NSMALL + NLARGE];
+
+// Block size of class cls.
+static uint
+clssize(int cls)
 {
-  Header *bp, *p;
+  if(cls < NSMALL)
+    return small[cls];
+  return 1 << (LARGE0 + cls - NSMALL);
+}
 
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+// Smallest class whose blocks hold n bytes plus a header,
+// or -1 if n is too big.
+static int
+sizecls(uint n)
+{
+  int cls;
+
+  if(n > (1U << (LARGE0 + NLARGE - 1)) - sizeof(Header))
+    return -1;
+  n += sizeof(Header);
+  if(n <= small[NSMALL-1]){
+    for(cls = 0; small[cls] < n; cls++)
+      ;
+    return cls;
+  }
+  for(cls = NSMALL; clssize(cls) < n; cls++)
+    ;
+  return cls;
 }
 
-static Header*
-morecore(uint nu)
+// Get more blocks of class cls onto its free list.
+static int
+morecore(int cls)
 {
+  uint sz, n, pad;
   char *p;
   Header *hp;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
+  sz = clssize(cls);
+  n = sz < CHUNK ? CHUNK : sz;
+  // someone else may have left the break unaligned.
+  pad = -(uint64)sbrk(0) & (sizeof(Header) - 1);
+  p = sbrk(n + pad);
   if(p == (char*)-1)
-    return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+    return -1;
+  p += pad;
+  for(; n >= sz; n -= sz, p += sz){
+    hp = (Header*)p;
+    hp->s.cls = cls;
+    hp->s.next = freelist[cls];
+    freelist[cls] = hp;
+  }
+  return 0;
+}
+
+void
+free(void *ap)
+{
+  Header *bp;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  bp->s.next = freelist[bp->s.cls];
+  freelist[bp->s.cls] = bp;
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
+  Header *p;
+  int cls;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  if((cls = sizecls(nbytes)) < 0)
+    return 0;
+  if(freelist[cls] == 0 && morecore(cls) < 0)
+    return 0;
+  p = freelist[cls];
+  freelist[cls] = p->s.next;
+  return (void*)(p + 1);
+}
+
+void*
+calloc(uint n, uint size)
+{
+  void *p;
+
+  if(size != 0 && n > 0xffffffffU / size)
+    return 0;
+  if((p = malloc(n * size)) != 0)
+    memset(p, 0, n * size);
+  return p;
+}
+
+void*
+realloc(void *ap, uint nbytes)
+{
+  Header *bp;
+  uint have;
+  void *p;
+
+  if(ap == 0)
+    return malloc(nbytes);
+  if(nbytes == 0){
+    free(ap);
+    return 0;
   }
+  bp = (Header*)ap - 1;
+  have = clssize(bp->s.cls) - sizeof(Header);
+  if(nbytes <= have)
+    return ap;
+  if((p = malloc(nbytes)) == 0)
+    return 0;
+  memmove(p, ap, have);
+  free(ap);
+  return p;
 }
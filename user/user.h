@@ -1,6 +1,11 @@
 struct stat;
 struct rtcdate;
 struct pstat;
+struct lockstat;
+struct memstat;
+struct direntplus;
+struct iovec;
+struct blkstat;
 
 // system calls
 int fork(void);
@@ -25,6 +30,24 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int getprocs(struct pstat*);
+int lockstat(const char*, struct lockstat*);
+void* mmap(void*, uint, int, int, int, uint);
+int munmap(void*, uint);
+int memstat(struct memstat*);
+int splice(int, int, int);
+int getdents(int, struct direntplus*, int, int);
+int fstatat(int, const char*, struct stat*);
+long lseek(int, long, int);
+int pread(int, void*, int, long);
+int pwrite(int, const void*, int, long);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int blkstat(struct blkstat*);
+int diskpoll(int);
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
+int _close(int);
+int _exec(char*, char**);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -34,11 +57,19 @@ char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
-char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
+void* calloc(uint, uint);
+void* realloc(void*, uint);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void* memchr(const void*, int, uint);
+
+// stdio.c
+void putc(int, char);
+int fflush(int);
+char* fgets(char*, int max, int);
+char* gets(char*, int max);
@@ -7,6 +7,8 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/mman.h"
+#include "kernel/uio.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2003,6 +2005,75 @@ dirfile(char *s)
   close(fd);
 }
 
+// splice() a file into a pipe and the pipe into another file.
+void
+splicetest(char *s)
+{
+  enum { N = 5000 };
+  char *buf;
+  int fd, fds[2], i, n;
+
+  buf = malloc(N);
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 26;
+  unlink("splice1");
+  unlink("splice2");
+  fd = open("splice1", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("%s: write splice1 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fd = open("splice1", O_RDONLY);
+  if(splice(fd, fds[0], 10) >= 0 || splice(fds[1], fd, 10) >= 0){
+    printf("%s: splice in the wrong direction succeeded\n", s);
+    exit(1);
+  }
+  // more than fits in the pipe, so the reader must drain it.
+  if(fork() == 0){
+    close(fds[0]);
+    if(splice(fd, fds[1], N+100) != N){
+      printf("%s: splice file to pipe failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  close(fd);
+  close(fds[1]);
+  fd = open("splice2", O_CREATE|O_RDWR);
+  for(i = 0; (n = splice(fds[0], fd, N)) > 0; i += n)
+    ;
+  wait(0);
+  if(n < 0 || i != N){
+    printf("%s: splice pipe to file moved %d bytes\n", s, i);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fd);
+
+  memset(buf, 0, N);
+  fd = open("splice2", O_RDONLY);
+  if(read(fd, buf, N) != N){
+    printf("%s: read splice2 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < N; i++){
+    if(buf[i] != 'a' + i % 26){
+      printf("%s: spliced data wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+  unlink("splice1");
+  unlink("splice2");
+  free(buf);
+}
+
 // test that iput() is called at the end of _namei().
 // also tests empty file names.
 void
@@ -2080,6 +2151,523 @@ forktest(char *s)
   }
 }
 
+// fork a process whose memory is more than half of
+// physical memory, which only works if fork() shares
+// pages copy-on-write, and check that the child's
+// writes (by store and by system call) stay private.
+void
+cowfork(char *s)
+{
+  enum { SZ = (128*1024*1024 / 3) * 2 };
+  char *a, *p;
+  int pid, xstatus, fds[2];
+
+  a = sbrk(SZ);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%d) failed\n", s, SZ);
+    exit(1);
+  }
+  for(p = a; p < a + SZ; p += 4096)
+    *(int*)p = getpid();
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + 10*4096; p += 4096)
+      *(int*)p = getpid();
+    if(pipe(fds) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    write(fds[1], "cow", 4);
+    if(read(fds[0], a + 10*4096, 4) != 4 || strcmp(a + 10*4096, "cow") != 0){
+      printf("%s: read into copy-on-write page failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  for(p = a; p < a + SZ; p += 4096){
+    if(*(int*)p != getpid()){
+      printf("%s: child's write changed parent's memory\n", s);
+      exit(1);
+    }
+  }
+}
+
+// mmap() a file private and shared, check that only shared
+// writes reach the file (after munmap(), including of part
+// of a region), that a fork()ed child sees a shared file
+// region, and that anonymous shared memory is shared with it.
+void
+mmaptest(char *s)
+{
+  enum { SZ = 3*4096 };
+  char *a, *b, buf[16];
+  int fd, i, pid, xstatus;
+
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create mmapfile failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i += sizeof(buf)){
+    memset(buf, 'a' + i/4096, sizeof(buf));
+    write(fd, buf, sizeof(buf));
+  }
+
+  a = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  if(a[0] != 'a' || a[4096] != 'b' || a[SZ-1] != 'c'){
+    printf("%s: mmap private read wrong data\n", s);
+    exit(1);
+  }
+  a[0] = 'x';
+  if(munmap(a, SZ) < 0){
+    printf("%s: munmap private failed\n", s);
+    exit(1);
+  }
+
+  b = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(b == (char*)0xffffffffffffffffL){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  if(b[0] != 'a'){
+    printf("%s: private write reached the file\n", s);
+    exit(1);
+  }
+  b[1] = 'y';
+  b[4096+1] = 'z';
+  // unmap the middle page, then the rest.
+  if(munmap(b + 4096, 4096) < 0 || munmap(b, 4096) < 0 ||
+     munmap(b + 2*4096, 4096) < 0){
+    printf("%s: munmap shared failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  read(fd, buf, 2);
+  if(buf[0] != 'a' || buf[1] != 'y'){
+    printf("%s: shared write did not reach the file\n", s);
+    exit(1);
+  }
+  read(fd, buf, 4096-2);
+  read(fd, buf, 2);
+  if(buf[0] != 'b' || buf[1] != 'z'){
+    printf("%s: shared write did not reach the file\n", s);
+    exit(1);
+  }
+
+  // fork() with a shared file region none of whose pages
+  // have been touched yet.
+  b = mmap(0, SZ, PROT_READ, MAP_SHARED, fd, 0);
+  if(b == (char*)0xffffffffffffffffL){
+    printf("%s: mmap shared read-only failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(b[0] != 'a' || b[1] != 'y' || b[4096+1] != 'z' || b[SZ-1] != 'c'){
+      printf("%s: child read wrong data from shared region\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  munmap(b, SZ);
+  close(fd);
+  unlink("mmapfile");
+
+  a = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: mmap anonymous failed\n", s);
+    exit(1);
+  }
+  a[0] = 1;
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[0] = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(a[0] != 2){
+    printf("%s: child's write to shared memory not seen\n", s);
+    exit(1);
+  }
+  munmap(a, 4096);
+}
+
+// getdents() returns every entry of a directory, with the
+// right type and size, however the calls are batched; and
+// fstatat() finds names relative to a directory fd.
+void
+getdentstest(char *s)
+{
+  enum { N = 40, BATCH = 7 };
+  struct direntplus ents[BATCH];
+  struct stat st;
+  char name[DIRSIZ+1], path[8], seen[N];
+  int dfd, fd, i, j, k, n, dots;
+
+  if(mkdir("gdd") < 0){
+    printf("%s: mkdir gdd failed\n", s);
+    exit(1);
+  }
+  strcpy(path, "gdd/g?");
+  for(i = 0; i < N; i++){
+    path[5] = '0' + i;
+    fd = open(path, O_CREATE|O_RDWR);
+    if(fd < 0 || write(fd, "xxxxxxxxxx", i % 10) != i % 10){
+      printf("%s: create %s failed\n", s, path);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  if((dfd = open("gdd", O_RDONLY)) < 0){
+    printf("%s: open gdd failed\n", s);
+    exit(1);
+  }
+  memset(seen, 0, sizeof(seen));
+  dots = 0;
+  while((n = getdents(dfd, ents, BATCH, 1)) > 0){
+    for(j = 0; j < n; j++){
+      memmove(name, ents[j].name, DIRSIZ);
+      name[DIRSIZ] = 0;
+      if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0){
+        if(ents[j].type != T_DIR){
+          printf("%s: %s is not a directory\n", s, name);
+          exit(1);
+        }
+        dots++;
+        continue;
+      }
+      k = name[1] - '0';
+      if(name[0] != 'g' || name[2] != 0 || k < 0 || k >= N || seen[k]){
+        printf("%s: unexpected entry %s\n", s, name);
+        exit(1);
+      }
+      seen[k] = 1;
+      if(ents[j].type != T_FILE || ents[j].nlink != 1 || ents[j].size != k % 10){
+        printf("%s: wrong stat for %s\n", s, name);
+        exit(1);
+      }
+      if(fstatat(dfd, name, &st) < 0 || st.ino != ents[j].inum || st.size != k % 10){
+        printf("%s: fstatat %s failed\n", s, name);
+        exit(1);
+      }
+    }
+  }
+  if(n < 0 || dots != 2){
+    printf("%s: getdents failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(!seen[i]){
+      printf("%s: entry %d missing\n", s, i);
+      exit(1);
+    }
+  }
+  if(fstatat(dfd, "nonexistent", &st) >= 0 || fstatat(dfd, "..", &st) < 0 || st.type != T_DIR){
+    printf("%s: fstatat of missing or parent wrong\n", s);
+    exit(1);
+  }
+  close(dfd);
+
+  // not a directory.
+  fd = open("gdd/g1", O_RDONLY);
+  if(getdents(fd, ents, BATCH, 0) >= 0){
+    printf("%s: getdents of a file succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    path[5] = '0' + i;
+    unlink(path);
+  }
+  if(unlink("gdd") < 0){
+    printf("%s: unlink gdd failed\n", s);
+    exit(1);
+  }
+}
+
+// pread() and pwrite() work at the given offset without
+// moving the fd's offset, even from two processes sharing
+// the fd, and lseek() moves it.
+void
+preadtest(char *s)
+{
+  enum { N = 3000 };
+  char buf[100];
+  int fd, fds[2], i, pid, xstatus;
+
+  unlink("preadf");
+  fd = open("preadf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create preadf failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    buf[i % sizeof(buf)] = 'a' + i % 26;
+    if(i % sizeof(buf) == sizeof(buf) - 1 && write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write preadf failed\n", s);
+      exit(1);
+    }
+  }
+
+  if(lseek(fd, 0, SEEK_CUR) != N || lseek(fd, 10, SEEK_SET) != 10){
+    printf("%s: lseek failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 5, 2000) != 5 || buf[0] != 'a' + 2000 % 26 || buf[4] != 'a' + 2004 % 26){
+    printf("%s: pread wrong\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 10, N - 3) != 3 || pread(fd, buf, 10, N + 100) != 0){
+    printf("%s: pread at end wrong\n", s);
+    exit(1);
+  }
+  if(read(fd, buf, 1) != 1 || buf[0] != 'a' + 10 % 26){
+    printf("%s: pread moved the offset\n", s);
+    exit(1);
+  }
+
+  // the child and parent write different blocks at once.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 50; i++){
+    buf[0] = pid == 0 ? 'C' : 'P';
+    if(pwrite(fd, buf, 1, (pid == 0 ? 0 : 1024) + i) != 1){
+      printf("%s: pwrite failed\n", s);
+      exit(1);
+    }
+  }
+  if(pid == 0)
+    exit(0);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(lseek(fd, 0, SEEK_CUR) != 11){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  if(lseek(fd, -10, SEEK_END) != N - 10 || read(fd, buf, 100) != 10){
+    printf("%s: lseek from the end failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 1, SEEK_END) >= 0 || lseek(fd, -1, SEEK_SET) >= 0 || pwrite(fd, buf, 1, N + 1) >= 0){
+    printf("%s: seek or pwrite past the end succeeded\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 50; i++){
+    if(pread(fd, buf, 1, i) != 1 || buf[0] != 'C' || pread(fd, buf, 1, 1024 + i) != 1 || buf[0] != 'P'){
+      printf("%s: pwrite data wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(lseek(fds[0], 0, SEEK_SET) >= 0 || pread(fds[0], buf, 1, 0) >= 0 || pwrite(fds[1], buf, 1, 0) >= 0){
+    printf("%s: positioned I/O on a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("preadf");
+}
+
+// writev() and readv() gather and scatter segments in order,
+// through files and pipes, and reject bad segment counts.
+void
+readvtest(char *s)
+{
+  static char big[3000], back[3000];
+  char hdr[5], mid[1], end[100];
+  struct iovec iov[4];
+  int fd, fds[2], i, n;
+
+  for(i = 0; i < sizeof(big); i++)
+    big[i] = 'a' + i % 26;
+  memmove(hdr, "HEAD:", 5);
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = 5;
+  iov[1].iov_base = 0;       // empty segments are skipped
+  iov[1].iov_len = 0;
+  iov[2].iov_base = big;
+  iov[2].iov_len = sizeof(big);
+  iov[3].iov_base = "!";
+  iov[3].iov_len = 1;
+
+  unlink("readvf");
+  fd = open("readvf", O_CREATE|O_RDWR);
+  if(fd < 0 || writev(fd, iov, 4) != 5 + sizeof(big) + 1){
+    printf("%s: writev to file failed\n", s);
+    exit(1);
+  }
+  if(writev(fd, iov, -1) >= 0 || writev(fd, iov, IOV_MAX + 1) >= 0){
+    printf("%s: writev with a bad count succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // read it back split differently: 3, 1, 3000, and up to 100.
+  fd = open("readvf", O_RDONLY);
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = 3;
+  iov[1].iov_base = mid;
+  iov[1].iov_len = 1;
+  iov[2].iov_base = back;
+  iov[2].iov_len = sizeof(back);
+  iov[3].iov_base = end;
+  iov[3].iov_len = sizeof(end);
+  if((n = readv(fd, iov, 4)) != 5 + sizeof(big) + 1){
+    printf("%s: readv from file returned %d\n", s, n);
+    exit(1);
+  }
+  if(memcmp(hdr, "HEA", 3) != 0 || mid[0] != 'D' || back[0] != ':' ||
+     memcmp(back + 1, big, sizeof(back) - 1) != 0 ||
+     end[0] != big[sizeof(big) - 1] || end[1] != '!'){
+    printf("%s: readv from file got wrong data\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, 4) != 0){
+    printf("%s: readv at end of file failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("readvf");
+
+  // through a pipe.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "xy";
+  iov[0].iov_len = 2;
+  iov[1].iov_base = big;
+  iov[1].iov_len = 100;
+  if(writev(fds[1], iov, 2) != 102){
+    printf("%s: writev to pipe failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = mid;
+  iov[0].iov_len = 1;
+  iov[1].iov_base = back;
+  iov[1].iov_len = sizeof(back);
+  if(readv(fds[0], iov, 2) != 102 || mid[0] != 'x' || back[0] != 'y' ||
+     memcmp(back + 1, big, 100) != 0){
+    printf("%s: readv from pipe got wrong data\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// sequential reads, which the kernel reads ahead of, see what
+// was written, even to blocks that were being read ahead.
+void
+readaheadtest(char *s)
+{
+  enum { NB = 100 };
+  char buf[BSIZE];
+  int fd, i, j, pid, xstatus;
+
+  unlink("raf");
+  fd = open("raf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create raf failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NB; i++){
+    memset(buf, 'a' + i % 26, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write raf failed\n", s);
+      exit(1);
+    }
+  }
+
+  // two readers at once, in pieces that straddle blocks.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NB * BSIZE; i += 100){
+    if(pread(fd, buf, 100, i) != (i + 100 <= NB * BSIZE ? 100 : NB * BSIZE - i)){
+      printf("%s: pread raf failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < 100 && i + j < NB * BSIZE; j++){
+      if(buf[j] != 'a' + (i + j) / BSIZE % 26){
+        printf("%s: wrong data at %d\n", s, i + j);
+        exit(1);
+      }
+    }
+  }
+  if(pid == 0)
+    exit(0);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  // read half way, so the blocks after are being read ahead,
+  // then overwrite them, and read on.
+  for(i = 0; i < NB; i++){
+    if(i == NB / 2){
+      memset(buf, 'X', sizeof(buf));
+      for(j = i; j < i + 20; j++){
+        if(pwrite(fd, buf, sizeof(buf), j * BSIZE) != sizeof(buf)){
+          printf("%s: pwrite raf failed\n", s);
+          exit(1);
+        }
+      }
+    }
+    if(pread(fd, buf, sizeof(buf), i * BSIZE) != sizeof(buf)){
+      printf("%s: pread raf failed\n", s);
+      exit(1);
+    }
+    if(buf[0] != (i >= NB / 2 && i < NB / 2 + 20 ? 'X' : 'a' + i % 26) ||
+       buf[BSIZE - 1] != buf[0]){
+      printf("%s: block %d wrong after overwrite\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("raf");
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2204,6 +2792,37 @@ sbrkmuch(char *s)
   }
 }
 
+// sbrk() memory is allocated lazily: a huge sparse heap
+// that is mostly only read must not run out of memory,
+// and must read as zeros.
+void
+sbrklazy(char *s)
+{
+  enum { BIG=512*1024*1024 };
+  char *a, *p;
+
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%d) failed\n", s, BIG);
+    exit(1);
+  }
+  for(p = a; p < a + BIG; p += 64*4096){
+    if(*p != 0){
+      printf("%s: untouched heap not zero\n", s);
+      exit(1);
+    }
+  }
+  a[BIG/2] = 1;
+  if(a[BIG/2] != 1 || a[BIG/2 + 4096] != 0 || a[BIG/2 - 4096] != 0){
+    printf("%s: write to lazily allocated page went wrong\n", s);
+    exit(1);
+  }
+  if(sbrk(-BIG) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk could not shrink sparse heap\n", s);
+    exit(1);
+  }
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2305,10 +2924,12 @@ sbrkfail(char *s)
     // allocate a lot of memory.
     // this should produce a page fault,
     // and thus not complete.
+    // (reads alone would just map the shared zero page.)
     a = sbrk(0);
     sbrk(10*BIG);
     int n = 0;
     for (i = 0; i < 10*BIG; i += PGSIZE) {
+      *(a+i) = 1;
       n += *(a+i);
     }
     // print n so the compiler doesn't optimize away
@@ -2855,6 +3476,7 @@ main(int argc, char *argv[])
     {bsstest, "bsstest"},
     {sbrkbasic, "sbrkbasic"},
     {sbrkmuch, "sbrkmuch"},
+    {sbrklazy, "sbrklazy"},
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
@@ -2871,6 +3493,7 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {splicetest, "splicetest"},
     {killstatus, "killstatus"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
@@ -2880,6 +3503,12 @@ main(int argc, char *argv[])
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {cowfork, "cowfork"},
+    {mmaptest, "mmaptest"},
+    {getdentstest, "getdentstest"},
+    {preadtest, "preadtest"},
+    {readvtest, "readvtest"},
+    {readaheadtest, "readaheadtest"},
     {bigdir, "bigdir"}, // slow
     { 0, 0},
   };
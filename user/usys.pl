@@ -6,24 +6,26 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry("x", "_x") names the stub _x, for stdio.c to wrap.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $label = shift || $name;
+    print ".global $label\n";
+    print "${label}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
-entry("close");
+entry("close", "_close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -37,3 +39,17 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("getprocs");
+entry("lockstat");
+entry("mmap");
+entry("munmap");
+entry("memstat");
+entry("splice");
+entry("getdents");
+entry("fstatat");
+entry("lseek");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("blkstat");
+entry("diskpoll");